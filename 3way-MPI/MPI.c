@@ -1,6 +1,782 @@
+// sched_getcpu and the CPU_SET macros used by common/affinity.h are GNU extensions
+#define _GNU_SOURCE
 #include <mpi.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../common/affinity.h"
+#include "../common/approx.h"
+#include "../common/aggregate.h"
+#include "../common/counters.h"
+#include "../common/digest.h"
+#include "../common/kernel.h"
+#include "../common/lineindex.h"
+#include "../common/options.h"
+#include "../common/outbuf.h"
+
+// MPI counts are ints, so large buffers are sent and written in pieces of at most this many bytes
+#define MPI_PIECE (1 << 30)
+
+// the ranks in the order of the file ranges they scan; MPI_COMM_WORLD, unless --shm groups them by node
+static MPI_Comm scan_comm;
+
+// --class: the byte class the lines' maxima are taken over, the printable bytes (32-126) by default
+static struct byte_class line_class;
+
+// bytes held in input buffers and result arrays by this rank, reported by --stats
+static double input_bytes = 0, result_bytes = 0;
+
+// MPI-IO hints in the same "key=value,..." form as --io-hints, which adds to and overrides them
+#define IO_HINTS_ENV "THREEWAY_IO_HINTS"
+
+// the hints every file is opened with: MPI_INFO_NULL unless $THREEWAY_IO_HINTS or --io-hints set any
+static MPI_Info io_info = MPI_INFO_NULL;
+
+// per-rank scan state. A rank owns every line whose first byte lies in its chunk: the bytes before its
+// first newline belong to a line owned by a lower rank (unless the chunk starts right after a newline),
+// and its own last line may run on into the following ranks' chunks
+struct rank_scan
+{
+    int in_lead;            // still inside the line continued from a lower rank
+    unsigned lead_max;      // maximum of the continued line's bytes within this chunk
+    int line_open;          // an owned line has started and its newline hasn't been seen yet
+    unsigned cur;           // maximum of the current owned line so far
+    unsigned char *vals;    // dynamically growing array with one value per owned line
+    size_t n, cap;
+    int shared;             // vals is a slice of a shared result array sized exactly for this rank
+};
+
+static void scan_init(struct rank_scan *sc, int continues_line)
+{
+    sc->in_lead = continues_line;
+    sc->lead_max = 0;
+    sc->line_open = 0;
+    sc->cur = 0;
+    sc->n = 0;
+    sc->cap = 1024;
+    sc->vals = malloc(sc->cap);
+    sc->shared = 0;
+}
+
+// like scan_init, but the values are written into dest, which has room for exactly 'lines' values
+static void scan_init_into(struct rank_scan *sc, int continues_line, unsigned char *dest, size_t lines)
+{
+    scan_init(sc, continues_line);
+    free(sc->vals);
+    sc->vals = dest;
+    sc->cap = lines;
+    sc->shared = 1;
+}
+
+static void scan_append(struct rank_scan *sc, unsigned value)
+{
+    if(sc->n == sc->cap)
+    {
+        // a shared slice is sized from the line count, so running out of room means the count was wrong
+        if(sc->shared)
+        {
+            fprintf(stderr, "Shared result array overflow\n");
+            MPI_Abort(MPI_COMM_WORLD, 4);
+        }
+        sc->cap <<= 1;
+        sc->vals = realloc(sc->vals, sc->cap);
+    }
+    sc->vals[sc->n++] = (unsigned char)value;
+}
+
+// scans the next piece [p, e) of this rank's chunk one line at a time: scan_line_class raises the
+// current maximum to the largest value in byte class id (by default printable ASCII, 32-126) up to the
+// next newline, jumping straight to that newline once nothing can raise it further; on a newline the
+// line's value is appended. Pieces must be passed in order and any line can span several of them; id is
+// a constant wherever this is inlined, so each class gets its own loop
+CLASS_KERNEL void scan_piece_class(int id, struct rank_scan *sc, const char *p, const char *e)
+{
+    if(sc->in_lead)
+    {
+        p = scan_line_class(id, &line_class, p, e, &sc->lead_max);
+        if(p == e)
+            return;
+        sc->in_lead = 0;
+        ++p;
+    }
+    while(p < e)
+    {
+        sc->line_open = 1;
+        p = scan_line_class(id, &line_class, p, e, &sc->cur);
+        if(p == e)
+            return;
+        scan_append(sc, sc->cur);
+        sc->cur = 0;
+        sc->line_open = 0;
+        ++p;
+    }
+}
+
+// scans a piece with the kernel of the chosen class, see scan_piece_class
+static void scan_piece(struct rank_scan *sc, const char *p, const char *e)
+{
+    switch(line_class.id)
+    {
+    case CLASS_PRINTABLE:
+        scan_piece_class(CLASS_PRINTABLE, sc, p, e);
+        break;
+    case CLASS_ASCII:
+        scan_piece_class(CLASS_ASCII, sc, p, e);
+        break;
+    case CLASS_ALNUM:
+        scan_piece_class(CLASS_ALNUM, sc, p, e);
+        break;
+    case CLASS_LETTERS:
+        scan_piece_class(CLASS_LETTERS, sc, p, e);
+        break;
+    default:
+        scan_piece_class(CLASS_SET, sc, p, e);
+        break;
+    }
+}
+
+// finishes the scan once the whole chunk was passed in: every rank shares the maximum of the continued
+// line's bytes it holds and whether that line ends in its chunk, so a rank whose last line is still open
+// raises it by each following rank's share, up to the rank where the line ends
+static void scan_finish(struct rank_scan *sc, int rank, int nprocs)
+{
+    unsigned mine[2] = { sc->lead_max, (unsigned)sc->in_lead };
+    unsigned *all = malloc(2 * nprocs * sizeof *all);
+    MPI_Allgather(mine, 2, MPI_UNSIGNED, all, 2, MPI_UNSIGNED, scan_comm);
+    if(sc->line_open)
+    {
+        unsigned value = sc->cur;
+        for(int r = rank + 1; r < nprocs; ++r)
+        {
+            if(all[2 * r] > value)
+                value = all[2 * r];
+            if(!all[2 * r + 1])
+                break;
+        }
+        scan_append(sc, value);
+    }
+    free(all);
+}
+
+// allocates a local buffer of size bytes and each rank reads its chunk simultaneously at the given offset
+// 'begin' with one collective read (so a chunk is limited to 2 GB). MPI_CHAR tells MPI to treat each of
+// the byte elements in the buffer as one char. Ranks other than 0 also read the byte just before their
+// chunk to find out whether it starts on a line boundary
+static void read_whole(MPI_File fh, MPI_Offset begin, MPI_Offset bytes, int rank, struct rank_scan *sc)
+{
+    MPI_Offset extra = (rank && bytes) ? 1 : 0;
+    char *buf = (bytes ? malloc(bytes + extra) : NULL);
+    input_bytes += bytes + extra;
+    MPI_File_read_at_all(fh, begin - extra, buf, (int)(bytes + extra), MPI_CHAR, MPI_STATUS_IGNORE);
+
+    scan_init(sc, rank && !(extra && buf[0] == '\n'));
+    if(bytes)
+        scan_piece(sc, buf + extra, buf + extra + bytes);
+    free(buf);
+}
+
+// pipelined read: the chunk is read in slabs of at most 'slab' bytes with MPI_File_iread_at_all into two
+// alternating buffers, so slab k+1 is in flight while slab k is scanned and a rank never holds more than
+// two slabs; lines spanning slab edges are carried over by the scan state. Collective reads have to be
+// called the same number of times on every rank, so ranks with fewer slabs post empty reads at the end
+static void read_slabs(MPI_File fh, MPI_Offset begin, MPI_Offset bytes, MPI_Offset slab, int rank,
+                       struct rank_scan *sc)
+{
+    // the byte just before the chunk tells whether it starts on a line boundary
+    char prev = '\n';
+    if(rank && bytes)
+        MPI_File_read_at(fh, begin - 1, &prev, 1, MPI_CHAR, MPI_STATUS_IGNORE);
+    scan_init(sc, rank && !(bytes && prev == '\n'));
+
+    long long nslabs = (bytes + slab - 1) / slab, maxslabs;
+    MPI_Allreduce(&nslabs, &maxslabs, 1, MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+
+    MPI_Offset bufsize = (bytes < slab) ? (bytes ? bytes : 1) : slab;
+    char *bufs[2] = { malloc(bufsize), malloc(bufsize) };
+    input_bytes += 2.0 * bufsize;
+    MPI_Offset len[2] = { 0, 0 };
+    MPI_Request req[2];
+    if(!bufs[0] || !bufs[1])
+    {
+        fprintf(stderr, "Allocation failure\n");
+        MPI_Abort(MPI_COMM_WORLD, 3);
+    }
+
+    for(long long k = 0; k <= maxslabs; ++k)
+    {
+        // posts the read of slab k (empty once this rank's slabs are done) ...
+        if(k < maxslabs)
+        {
+            int b = (int)(k % 2);
+            MPI_Offset off = k * slab;
+            len[b] = (k < nslabs) ? ((bytes - off < slab) ? bytes - off : slab) : 0;
+            MPI_File_iread_at_all(fh, begin + (len[b] ? off : 0), bufs[b], (int)len[b], MPI_CHAR, &req[b]);
+        }
+
+        // ... then waits for slab k-1, which was in flight meanwhile, and scans it
+        if(k > 0)
+        {
+            int b = (int)((k - 1) % 2);
+            MPI_Wait(&req[b], MPI_STATUS_IGNORE);
+            if(len[b])
+                scan_piece(sc, bufs[b], bufs[b] + len[b]);
+        }
+    }
+    free(bufs[0]);
+    free(bufs[1]);
+}
+
+// state of the shared-memory mode (--shm)
+struct node_share
+{
+    MPI_Comm node_comm;       // the ranks on this node
+    MPI_Comm leader_comm;     // rank 0 of every node; MPI_COMM_NULL on the other ranks
+    int node_rank, node_size;
+    MPI_Win data_win;         // the node's part of the file, plus the byte before it at index 0
+    MPI_Win result_win;       // one value per line owned by any rank of the node
+    unsigned char *results;
+    long long node_lines;
+};
+
+// synchronizes the node's ranks after writes into the shared windows, so that the others see them
+static void node_sync(struct node_share *ns)
+{
+    MPI_Win_sync(ns->data_win);
+    if(ns->result_win != MPI_WIN_NULL)
+        MPI_Win_sync(ns->result_win);
+    MPI_Barrier(ns->node_comm);
+}
+
+// allocates a shared window on the node: rank 0 of the node owns all of the memory, the others map it
+static char *node_alloc(struct node_share *ns, MPI_Aint size, MPI_Win *win)
+{
+    char *base;
+    MPI_Aint got;
+    int disp;
+    MPI_Win_allocate_shared(ns->node_rank ? 0 : (size ? size : 1), 1, MPI_INFO_NULL, ns->node_comm, &base, win);
+    MPI_Win_shared_query(*win, 0, &got, &disp, &base);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, *win);
+    return base;
+}
+
+// shared-memory mode: ranks are grouped by node with MPI_Comm_split_type. The file is split between the
+// nodes, and each node's range is read exactly once into one MPI_Win_allocate_shared window, every rank
+// of the node reading a slice of it. Each rank scans its slice in place and writes its values straight
+// into a shared per-node result array at the offset given by a node-local prefix sum of the line counts,
+// so no rank keeps a private copy of either; *vals/*n are set to this rank's part of the result array.
+// scan_comm is reordered so rank order follows file order (node by node)
+static void shm_scan(struct node_share *ns, MPI_File fh, MPI_Offset fsize, int *rank, int nprocs,
+                     unsigned char **vals, size_t *n)
+{
+    int world_rank = *rank, node_idx = 0, nnodes = 0;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, world_rank, MPI_INFO_NULL, &ns->node_comm);
+    MPI_Comm_rank(ns->node_comm, &ns->node_rank);
+    MPI_Comm_size(ns->node_comm, &ns->node_size);
+    MPI_Comm_split(MPI_COMM_WORLD, ns->node_rank ? MPI_UNDEFINED : 0, world_rank, &ns->leader_comm);
+    if(!ns->node_rank)
+    {
+        MPI_Comm_rank(ns->leader_comm, &node_idx);
+        MPI_Comm_size(ns->leader_comm, &nnodes);
+    }
+    MPI_Bcast(&node_idx, 1, MPI_INT, 0, ns->node_comm);
+    MPI_Bcast(&nnodes, 1, MPI_INT, 0, ns->node_comm);
+    MPI_Comm_split(MPI_COMM_WORLD, 0, node_idx * nprocs + ns->node_rank, &scan_comm);
+    MPI_Comm_rank(scan_comm, rank);
+
+    // the node's range of the file, and this rank's slice of it
+    MPI_Offset nchunk = (fsize + nnodes - 1) / nnodes;
+    MPI_Offset nbegin = node_idx * nchunk;
+    MPI_Offset nend = (nbegin + nchunk > fsize) ? fsize : nbegin + nchunk;
+    MPI_Offset nbytes = (nend > nbegin) ? nend - nbegin : 0;
+    MPI_Offset lo = nbytes * ns->node_rank / ns->node_size;
+    MPI_Offset hi = nbytes * (ns->node_rank + 1) / ns->node_size;
+
+    ns->result_win = MPI_WIN_NULL;
+    char *data = node_alloc(ns, nbytes + 1, &ns->data_win);
+    if(!ns->node_rank)
+        input_bytes += nbytes + 1;
+
+    // every rank reads its slice of the node's range with one collective read; the node's rank 0 also
+    // fetches the byte before the range, so every slice can tell whether it starts on a line boundary
+    if(!ns->node_rank)
+    {
+        data[0] = '\n';
+        if(node_idx && nbytes)
+            MPI_File_read_at(fh, nbegin - 1, data, 1, MPI_CHAR, MPI_STATUS_IGNORE);
+    }
+    long long pieces = (hi - lo + MPI_PIECE - 1) / MPI_PIECE, maxPieces;
+    MPI_Allreduce(&pieces, &maxPieces, 1, MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+    for(long long i = 0; i < maxPieces; i++)
+    {
+        MPI_Offset off = lo + i * (MPI_Offset)MPI_PIECE;
+        int count = (off < hi) ? (int)((hi - off < MPI_PIECE) ? hi - off : MPI_PIECE) : 0;
+        MPI_File_read_at_all(fh, nbegin + (off < hi ? off : hi), data + 1 + (off < hi ? off : hi), count,
+                             MPI_CHAR, MPI_STATUS_IGNORE);
+    }
+    node_sync(ns);
+
+    // a rank owns the lines that start in its slice: the first byte if it follows a newline, and the byte
+    // after every newline except one at the very end of the slice
+    int continues = (hi == lo) || data[lo] != '\n';
+    long long mine = (long long)((!continues ? 1 : 0) + (hi > lo ? lineidx_count(data + 1, lo, hi - 1) : 0));
+    long long offset = 0;
+    MPI_Exscan(&mine, &offset, 1, MPI_LONG_LONG, MPI_SUM, ns->node_comm);
+    if(!ns->node_rank)
+        offset = 0;
+    MPI_Allreduce(&mine, &ns->node_lines, 1, MPI_LONG_LONG, MPI_SUM, ns->node_comm);
+
+    ns->results = (unsigned char *)node_alloc(ns, ns->node_lines, &ns->result_win);
+    if(!ns->node_rank)
+        result_bytes += ns->node_lines;
+
+    struct rank_scan sc;
+    scan_init_into(&sc, continues, ns->results + offset, (size_t)mine);
+    scan_piece(&sc, data + 1 + lo, data + 1 + hi);
+    scan_finish(&sc, *rank, nprocs);
+    node_sync(ns);
+
+    *vals = sc.vals;
+    *n = sc.n;
+}
+
+// per-line output in shared-memory mode: only the node leaders take part, each sending its node's whole
+// result array to the first node's leader with one MPI_Gatherv, which prints them
+static void shm_output(struct node_share *ns, unsigned min_value)
+{
+    if(ns->leader_comm == MPI_COMM_NULL)
+        return;
+
+    int lrank, nleaders;
+    MPI_Comm_rank(ns->leader_comm, &lrank);
+    MPI_Comm_size(ns->leader_comm, &nleaders);
+
+    int myCount = (int)ns->node_lines;
+    int *counts = NULL, *displs = NULL;
+    unsigned char *allvals = NULL;
+    if(!lrank)
+    {
+        counts = malloc(nleaders * sizeof *counts);
+        displs = malloc(nleaders * sizeof *displs);
+    }
+    MPI_Gather(&myCount, 1, MPI_INT, counts, 1, MPI_INT, 0, ns->leader_comm);
+    if(!lrank)
+    {
+        displs[0] = 0;
+        for(int p = 1; p < nleaders; ++p)
+            displs[p] = displs[p-1] + counts[p-1];
+        allvals = malloc(displs[nleaders-1] + counts[nleaders-1] + 1);
+        if(nleaders > 1)
+            result_bytes += displs[nleaders-1] + counts[nleaders-1];
+    }
+    MPI_Gatherv(ns->results, myCount, MPI_UNSIGNED_CHAR, allvals, counts, displs, MPI_UNSIGNED_CHAR, 0,
+                ns->leader_comm);
+
+    if(!lrank)
+    {
+        long total = displs[nleaders-1] + counts[nleaders-1];
+        for(long idx = 0; idx < total; ++idx)
+        {
+            if(allvals[idx] >= min_value)
+                printf("%ld: %u\n", idx, allvals[idx]);
+        }
+        free(allvals);
+        free(counts);
+        free(displs);
+    }
+}
+
+// releases the windows and communicators of the shared-memory mode
+static void shm_free(struct node_share *ns)
+{
+    MPI_Win_unlock_all(ns->result_win);
+    MPI_Win_unlock_all(ns->data_win);
+    MPI_Win_free(&ns->result_win);
+    MPI_Win_free(&ns->data_win);
+    if(ns->leader_comm != MPI_COMM_NULL)
+        MPI_Comm_free(&ns->leader_comm);
+    MPI_Comm_free(&ns->node_comm);
+    MPI_Comm_free(&scan_comm);
+}
+
+// --stats: rank 0 reports the slowest rank's time for each phase and the bytes held in input buffers and
+// result arrays over all ranks, to compare the memory and copy cost of the read modes
+static void report_stats(double t_scan, double t_collect, double t_output, int rank)
+{
+    double times[3] = { t_scan, t_collect, t_output }, maxtimes[3];
+    double bytes[2] = { input_bytes, result_bytes }, sums[2];
+    MPI_Reduce(times, maxtimes, 3, MPI_DOUBLE, MPI_MAX, 0, scan_comm);
+    MPI_Reduce(bytes, sums, 2, MPI_DOUBLE, MPI_SUM, 0, scan_comm);
+    if(!rank)
+        fprintf(stderr, "stats: read+scan %.3f s, collect %.3f s, output %.3f s, "
+                "input buffers %.1f MB, result arrays %.1f MB\n",
+                maxtimes[0], maxtimes[1], maxtimes[2], sums[0] / 1048576, sums[1] / 1048576);
+}
+
+// --counters splits the run into these phases; reading and scanning overlap in the slab and shared modes,
+// so they're counted together
+enum { PHASE_SCAN, PHASE_OUTPUT, NPHASES };
+static const char *const phase_names[NPHASES] = { "read+scan", "output" };
+
+// --counters: every rank counts its own events per phase and rank 0 prints the sums over all ranks
+static void report_counters(struct counter_totals *phases, int rank)
+{
+    struct counter_totals sum[NPHASES];
+    MPI_Reduce(phases, sum, NPHASES * 2 * NCOUNTERS, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, scan_comm);
+    if(!rank)
+        counters_report(phase_names, sum, NPHASES);
+}
+
+// adds the hints of a "key=value,key=value" list to info, e.g. "cb_nodes=4,cb_buffer_size=16M,
+// romio_cb_read=enable,striping_factor=8,striping_unit=1M"; sizes may carry a K, M or G suffix, which
+// is expanded since MPI expects plain byte counts; returns -1 on a malformed entry
+static int add_io_hints(MPI_Info info, const char *list)
+{
+    char *copy = strdup(list), *save = NULL, num[32];
+    int rc = copy ? 0 : -1;
+    for(char *item = copy ? strtok_r(copy, ",", &save) : NULL; item && !rc; item = strtok_r(NULL, ",", &save))
+    {
+        char *value = strchr(item, '=');
+        unsigned long long v;
+        if(!value || value == item || value[1] == '\0')
+        {
+            rc = -1;
+            break;
+        }
+        *value++ = '\0';
+        if(parse_option_size(value, 0, ULLONG_MAX, &v) == 0)
+        {
+            snprintf(num, sizeof num, "%llu", v);
+            value = num;
+        }
+        MPI_Info_set(info, item, value);
+    }
+    free(copy);
+    return rc;
+}
+
+// builds io_info from $THREEWAY_IO_HINTS and then --io-hints, so the command line wins where both set a key
+static void setup_io_hints(const char *list, int rank)
+{
+    const char *env = getenv(IO_HINTS_ENV);
+    if(env && !*env)
+        env = NULL;
+    if(!env && !list)
+        return;
+    MPI_Info_create(&io_info);
+
+    // names whichever source is malformed, so a bad environment isn't blamed on a good --io-hints
+    const char *bad = NULL, *source = NULL;
+    if(env && add_io_hints(io_info, env) != 0)
+    {
+        bad = env;
+        source = "$" IO_HINTS_ENV;
+    }
+    else if(list && add_io_hints(io_info, list) != 0)
+    {
+        bad = list;
+        source = "--io-hints";
+    }
+    if(bad)
+    {
+        if(!rank)
+            fprintf(stderr, "Invalid MPI-IO hints in %s, expected key=value,key=value: %s\n", source, bad);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+}
+
+// --stats: reports the value the MPI library actually uses for every requested hint, or that it ignored
+// it; ROMIO drops hints that don't apply to the file system, and striping only applies to new files
+static void report_io_hints(MPI_File fh, int rank)
+{
+    MPI_Info used;
+    int nkeys, found;
+    char key[MPI_MAX_INFO_KEY + 1], value[256];
+    if(rank || io_info == MPI_INFO_NULL || MPI_File_get_info(fh, &used) != MPI_SUCCESS)
+        return;
+    MPI_Info_get_nkeys(io_info, &nkeys);
+    fprintf(stderr, "io hints:");
+    for(int k = 0; k < nkeys; ++k)
+    {
+        MPI_Info_get_nthkey(io_info, k, key);
+        MPI_Info_get(used, key, (int)sizeof value - 1, value, &found);
+        fprintf(stderr, " %s=%s", key, found ? value : "(ignored)");
+    }
+    fprintf(stderr, "\n");
+    MPI_Info_free(&used);
+}
+
+// --pin: pins every rank to its own CPU, numbering the ranks within their node (run mpirun with
+// --bind-to none, so each rank may pick from all of the node's CPUs)
+static void pin_rank(void)
+{
+    MPI_Comm node;
+    int node_rank;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+    MPI_Comm_rank(node, &node_rank);
+    MPI_Comm_free(&node);
+    affinity_pin(node_rank);
+}
+
+// --affinity: gathers the CPU every rank is on and its clock onto rank 0, which reports them in the
+// order of the ranks' file ranges
+static void report_affinity(int rank, int nprocs)
+{
+    double mine[2], *all = NULL;
+    mine[0] = sched_getcpu();
+    mine[1] = affinity_cpu_mhz((int)mine[0]);
+    if(!rank)
+        all = malloc(2 * (size_t)nprocs * sizeof *all);
+    MPI_Gather(mine, 2, MPI_DOUBLE, all, 2, MPI_DOUBLE, 0, scan_comm);
+    if(!rank)
+    {
+        int *cpus = malloc(nprocs * sizeof *cpus);
+        double *mhz = malloc(nprocs * sizeof *mhz);
+        for(int r = 0; r < nprocs; ++r)
+        {
+            cpus[r] = (int)all[2 * r];
+            mhz[r] = all[2 * r + 1];
+        }
+        affinity_report(cpus, mhz, nprocs);
+        free(cpus);
+        free(mhz);
+    }
+    free(all);
+}
+
+// returns the global number of this rank's first line: the exclusive prefix sum of the line counts of
+// all lower ranks
+static long long first_line_of_rank(size_t n, int rank)
+{
+    long long myLines = (long long)n, firstLine = 0;
+    MPI_Exscan(&myLines, &firstLine, 1, MPI_LONG_LONG, MPI_SUM, scan_comm);
+    return rank ? firstLine : 0; // MPI_Exscan leaves rank 0's result undefined
+}
+
+// parallel output mode: every rank formats its own lines into a private buffer, numbering them from
+// the exclusive prefix sum of the line counts of the lower ranks; the buffers are then either written
+// collectively into the output file at prefix-summed byte offsets, or streamed to rank 0 in rank order
+// and written to stdout there; only lines whose value is at least min_value are written
+static void parallel_output(const unsigned char *vals, size_t n, int rank, int nprocs, unsigned min_value,
+                            const char *output_path)
+{
+    long long firstLine = first_line_of_rank(n, rank);
+
+    struct out_buffer out;
+    if(out_buffer_init(&out, n) != 0)
+    {
+        fprintf(stderr, "Allocation failure\n");
+        MPI_Abort(MPI_COMM_WORLD, 3);
+    }
+    for(size_t i = 0; i < n; ++i)
+    {
+        if(vals[i] >= min_value)
+            out_append(&out, (size_t)firstLine + i, vals[i]);
+    }
+
+    if(output_path)
+    {
+        long long myBytes = (long long)out.len, offset = 0, pieces, maxPieces;
+        MPI_Exscan(&myBytes, &offset, 1, MPI_LONG_LONG, MPI_SUM, scan_comm);
+        if(!rank)
+            offset = 0;
+
+        // every rank has to take part in each collective write, so all ranks loop for as many rounds
+        // as the rank with the most pieces needs, writing nothing once their own bytes are done
+        pieces = (myBytes + MPI_PIECE - 1) / MPI_PIECE;
+        MPI_Allreduce(&pieces, &maxPieces, 1, MPI_LONG_LONG, MPI_MAX, scan_comm);
+
+        MPI_File fh;
+        if(MPI_File_open(scan_comm, output_path, MPI_MODE_WRONLY | MPI_MODE_CREATE,
+                         io_info, &fh) != MPI_SUCCESS)
+        {
+            if(!rank)
+                fprintf(stderr, "Unable to open %s\n", output_path);
+            MPI_Abort(MPI_COMM_WORLD, 2);
+        }
+        MPI_File_set_size(fh, 0);
+        for(long long p = 0, done = 0; p < maxPieces; ++p)
+        {
+            int len = (int)(myBytes - done > MPI_PIECE ? MPI_PIECE : myBytes - done);
+            MPI_File_write_at_all(fh, offset + done, out.data + done, len, MPI_CHAR, MPI_STATUS_IGNORE);
+            done += len;
+        }
+        MPI_File_close(&fh);
+    }
+    else if(!rank)
+    {
+        // rank 0 writes its own lines first, then each other rank's buffer as it arrives
+        write_all(STDOUT_FILENO, out.data, out.len);
+        char *recv = NULL;
+        for(int p = 1; p < nprocs; ++p)
+        {
+            long long len;
+            MPI_Recv(&len, 1, MPI_LONG_LONG, p, 0, scan_comm, MPI_STATUS_IGNORE);
+            recv = realloc(recv, len ? len : 1);
+            for(long long done = 0; done < len; done += MPI_PIECE)
+            {
+                int piece = (int)(len - done > MPI_PIECE ? MPI_PIECE : len - done);
+                MPI_Recv(recv + done, piece, MPI_CHAR, p, 1, scan_comm, MPI_STATUS_IGNORE);
+            }
+            write_all(STDOUT_FILENO, recv, len);
+        }
+        free(recv);
+    }
+    else
+    {
+        long long len = (long long)out.len;
+        MPI_Send(&len, 1, MPI_LONG_LONG, 0, 0, scan_comm);
+        for(long long done = 0; done < len; done += MPI_PIECE)
+        {
+            int piece = (int)(len - done > MPI_PIECE ? MPI_PIECE : len - done);
+            MPI_Send(out.data + done, piece, MPI_CHAR, 0, 1, scan_comm);
+        }
+    }
+    free(out.data);
+}
+
+// aggregate modes (--summary, --top-k, --digest): each rank folds its own lines into a private histogram,
+// top-K heap and digest; the histograms are summed onto rank 0 with MPI_Reduce and every rank's heap and
+// digest are gathered there to be merged, so only a few KB ever cross the network; only lines whose value
+// is at least --min-value are counted
+static void aggregate(const unsigned char *vals, size_t n, int rank, int nprocs, const struct run_options *opts)
+{
+    long long firstLine = first_line_of_rank(n, rank);
+    struct histogram local, total;
+    struct topk top;
+    struct digest dg;
+
+    hist_init(&local);
+    digest_init(&dg);
+    if(topk_init(&top, opts->top_k) != 0)
+    {
+        fprintf(stderr, "Allocation failure\n");
+        MPI_Abort(MPI_COMM_WORLD, 3);
+    }
+    for(size_t i = 0; i < n; ++i)
+    {
+        if(vals[i] < opts->min_value)
+            continue;
+        hist_add(&local, vals[i]);
+        topk_push(&top, vals[i], (unsigned long long)firstLine + i);
+        if(opts->digest)
+            digest_add(&dg, (unsigned long long)firstLine + i, vals[i]);
+    }
+
+    MPI_Reduce(local.count, total.count, 256, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, scan_comm);
+
+    if(opts->top_k)
+    {
+        // every rank sends exactly k (value, line) pairs so a plain MPI_Gather works; unused slots
+        // carry a line number of ULLONG_MAX and are skipped when merging
+        int k = (int)opts->top_k;
+        unsigned long long *mine = malloc(2 * (size_t)k * sizeof *mine);
+        unsigned long long *all = NULL;
+        if(!rank)
+            all = malloc(2 * (size_t)k * nprocs * sizeof *all);
+        if(!mine || (!rank && !all))
+        {
+            fprintf(stderr, "Allocation failure\n");
+            MPI_Abort(MPI_COMM_WORLD, 3);
+        }
+        for(int i = 0; i < k; ++i)
+        {
+            mine[2 * i] = (size_t)i < top.n ? top.heap[i].value : 0;
+            mine[2 * i + 1] = (size_t)i < top.n ? top.heap[i].line : ULLONG_MAX;
+        }
+        MPI_Gather(mine, 2 * k, MPI_UNSIGNED_LONG_LONG, all, 2 * k, MPI_UNSIGNED_LONG_LONG, 0, scan_comm);
+
+        if(!rank)
+        {
+            // rank 0's own entries are in the gathered array too, so start from an empty heap
+            top.n = 0;
+            for(size_t i = 0; i < (size_t)k * nprocs; ++i)
+            {
+                if(all[2 * i + 1] != ULLONG_MAX)
+                    topk_push(&top, (unsigned)all[2 * i], all[2 * i + 1]);
+            }
+        }
+        free(mine);
+        free(all);
+    }
+
+    // the digest depends on the order of the lines, so rank 0 appends every rank's partial digest in
+    // rank order, which is the order of their lines
+    if(opts->digest)
+    {
+        unsigned long long mine[2] = { dg.acc, dg.lines }, *all = NULL;
+        if(!rank)
+            all = malloc(2 * (size_t)nprocs * sizeof *all);
+        MPI_Gather(mine, 2, MPI_UNSIGNED_LONG_LONG, all, 2, MPI_UNSIGNED_LONG_LONG, 0, scan_comm);
+        if(!rank)
+        {
+            digest_init(&dg);
+            for(int r = 0; r < nprocs; ++r)
+            {
+                struct digest part = { all[2 * r], all[2 * r + 1] };
+                digest_merge(&dg, &part);
+            }
+        }
+        free(all);
+    }
+
+    if(!rank)
+    {
+        if(opts->summary)
+            hist_print(&total);
+        if(opts->top_k)
+            topk_print(&top);
+        if(opts->digest)
+            digest_print(&dg);
+    }
+    topk_free(&top);
+}
+
+// --approx: every rank builds the same plan from the seed and reads its share of the blocks (every nprocs-th)
+// with plain pread, so nothing but the blocks is read and MPI-IO isn't involved; the block count, the sums of
+// the blocks' totals and of their squares and the last block's totals are reduced onto rank 0, which prints
+// the estimates
+static void approx_scan(const char *fname, MPI_Offset fsize, int rank, int nprocs, const struct run_options *opts)
+{
+    struct approx_plan pl;
+    struct approx_sums local, total;
+    unsigned long long counts[APPROX_VARS];
+    if(approx_plan_init(&pl, (unsigned long long)fsize, opts->approx, opts->approx_seed) != 0)
+    {
+        fprintf(stderr, "Rank %d: out of memory\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    int fd = open(fname, O_RDONLY);
+    char *buf = malloc(pl.block + 1 > APPROX_TAIL ? pl.block + 1 : APPROX_TAIL);
+    if(fd < 0 || !buf)
+    {
+        perror(fd < 0 ? "open" : "malloc");
+        MPI_Abort(MPI_COMM_WORLD, 2);
+    }
+
+    approx_sums_init(&local);
+    for(size_t i = (size_t)rank; i < pl.nread; i += (size_t)nprocs)
+    {
+        if(approx_block_counts(fd, &pl, (unsigned long long)fsize, pl.sampled[i], &line_class, opts->min_value, buf,
+                               counts) != 0)
+            MPI_Abort(MPI_COMM_WORLD, 2);
+        approx_sums_add(&local, &pl, pl.sampled[i], counts);
+    }
+    free(buf);
+    close(fd);
+
+    approx_sums_init(&total);
+    MPI_Reduce(&local.blocks, &total.blocks, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(local.s1, total.s1, APPROX_VARS, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(local.s2, total.s2, APPROX_VARS, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(local.tail, total.tail, APPROX_VARS, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if(!rank)
+        approx_print(&pl, &total, (unsigned long long)fsize);
+    approx_plan_free(&pl);
+}
 
 int main(int argc, char *argv[])
 {
@@ -14,12 +790,17 @@ int main(int argc, char *argv[])
     // gets the total number of processes in MPI_COMM_WORLD
     MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
 
-    // Ensures there is only one argument other than the executable: the file path
-    if(argc != 2)
+    // Ensures there is only one argument other than the executable and its options: the file path
+    struct run_options opts;
+    const char *args[1] = { NULL };
+    if(parse_options(argc, argv, BACKEND_MPI, &opts, args, 1) != 1)
     {
         // only rank 0 prints this message, to avoid duplicates
         if(!rank)
-            fprintf(stderr, "Usage: %s <file>\n", argv[0]);
+        {
+            fprintf(stderr, "Usage: %s [options] <file>\n", argv[0]);
+            print_options_usage();
+        }
 
         // cleanly shuts down and returns
         MPI_Finalize();
@@ -27,7 +808,23 @@ int main(int argc, char *argv[])
     }
 
     // retrieves file name from the given arguments
-    const char * fname = argv[1];
+    const char * fname = args[0];
+
+    // --class: the byte class the maxima are taken over, printable unless another one is given
+    if(byte_class_init(&line_class, opts.byte_class) != 0)
+    {
+        if(!rank)
+            fprintf(stderr, "Invalid byte class: %s\n", opts.byte_class);
+        MPI_Finalize();
+        return 1;
+    }
+
+    // with --pin every rank stays on its own CPU from here on
+    if(opts.pin)
+        pin_rank();
+
+    // MPI-IO hints for opening the input and output, see setup_io_hints
+    setup_io_hints(opts.io_hints, rank);
 
     // inits file size to 0
     MPI_Offset fsize = 0;
@@ -46,10 +843,25 @@ int main(int argc, char *argv[])
         fseek(fs, 0, SEEK_END);
         fsize = ftell(fs);
         fclose(fs);
+
+        // --limit-bytes scans only the start of the file, in place of a head -c copy of it
+        if(opts.limit_bytes && (unsigned long long)fsize > opts.limit_bytes)
+            fsize = (MPI_Offset)opts.limit_bytes;
     }
     // broadcasts the file size to all ranks
     MPI_Bcast(&fsize, 1, MPI_OFFSET, 0, MPI_COMM_WORLD);
 
+    // --approx reads only the sampled blocks and prints its estimates in place of any other output
+    if(opts.approx)
+    {
+        if(fsize > 0)
+            approx_scan(fname, fsize, rank, nprocs, &opts);
+        if(io_info != MPI_INFO_NULL)
+            MPI_Info_free(&io_info);
+        MPI_Finalize();
+        return 0;
+    }
+
     // divides the file into roughly equal chunks and each rank computes its own begin and end byte
     // offsets into the file - and the bytes variable is the number of bytes this rank will actually
     // read, which could be zero for small remainders
@@ -58,114 +870,141 @@ int main(int argc, char *argv[])
     MPI_Offset end = (begin + chunk > fsize) ? fsize : begin + chunk;
     MPI_Offset bytes = (end > begin) ? end - begin : 0;
 
-    // opens file fh on all ranks in read-only mode
+    // with --counters every rank counts its own events from here on, see report_counters
+    struct counters ctr;
+    struct counter_totals phases[NPHASES];
+    memset(phases, 0, sizeof phases);
+    if(opts.counters)
+        counters_open(&ctr);
+
+    // opens file fh on all ranks in read-only mode, with the MPI-IO hints in io_info (if any)
     MPI_File fh;
-    MPI_File_open(MPI_COMM_WORLD, fname, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
-
-    // allocates a local buffer of size bytes and each rank reads its chunk simultaneously at the given
-    // offset 'begin'. MPI_CHAR tells MPI to treat each of the byte elements in the buffer as one char.
-    char *buf = (bytes ? malloc(bytes) : NULL);
-    MPI_File_read_at_all(fh, begin, buf, bytes, MPI_CHAR, MPI_STATUS_IGNORE);
-    // closes the MPI file handle
-    MPI_File_close(&fh);
-
-    // because we split by byte-offsets, non-zero ranks may start in the middle of a line; each non-zero
-    // line continues until it sees its first newline character, then starts line processing just after
-    // that newline; rank 0 starts at an offset of 0 (i.e. the beginning)
-    MPI_Offset off = 0;
-    if(rank)
-    {
-        while(off < bytes && buf[off] != '\n')
-            ++off;
-        if(off < bytes)
-            ++off;
-    }
-
-    // vals is a dynamically growing array (starting at 1024) that will store each line's maximum printable
-    // ASCII code
-    unsigned char *vals = NULL;
-    size_t cap = 1024, n = 0;
-    if(bytes)
+    MPI_File_open(MPI_COMM_WORLD, fname, MPI_MODE_RDONLY, io_info, &fh);
+    if(opts.stats)
+        report_io_hints(fh, rank);
+
+    // reads this rank's chunk and finds the maximum of every line it owns, either with one big read, slab
+    // by slab, or through the node's shared window (see read_whole, read_slabs and shm_scan); then closes
+    // the MPI file handle; vals holds each owned line's maximum printable ASCII code
+    double t0 = MPI_Wtime();
+    struct node_share ns;
+    unsigned char *vals;
+    size_t n;
+    scan_comm = MPI_COMM_WORLD;
+    if(opts.shm)
+    {
+        shm_scan(&ns, fh, fsize, &rank, nprocs, &vals, &n);
+        MPI_File_close(&fh);
+    }
+    else
     {
-        vals = malloc(cap);
+        struct rank_scan sc;
+        if(opts.slab_size)
+            read_slabs(fh, begin, bytes, (MPI_Offset)opts.slab_size, rank, &sc);
+        else
+            read_whole(fh, begin, bytes, rank, &sc);
+        MPI_File_close(&fh);
+        scan_finish(&sc, rank, nprocs);
+        vals = sc.vals;
+        n = sc.n;
+        result_bytes += sc.cap;
     }
+    double t_scan = MPI_Wtime() - t0, t_collect = 0, t_output;
+    if(opts.counters)
+        counters_take(&ctr, &phases[PHASE_SCAN]);
+    t0 = MPI_Wtime();
 
-    // loop from 'off' to bytes'; if the character isn't newline, update cur if it's a printable ASCII (32-116)
-    // and larger than the current max, on a newline append 'cur' to the 'vals' array, reset cur to 0, and continue;
-    // after the loop check for a final line without trailing newline and append it if needed; lastly free the read buffer
-    unsigned char cur = 0;
-    for(MPI_Offset i = off; i < bytes; ++i)
+    if(opts.summary || opts.top_k || opts.digest || opts.parallel_output)
     {
-        unsigned char c = (unsigned char)buf[i];
-        if(c != '\n')
+        // the aggregate modes and parallel output skip gathering the values on rank 0, see aggregate
+        // and parallel_output
+        if(opts.summary || opts.top_k || opts.digest)
+            aggregate(vals, n, rank, nprocs, &opts);
+        else
+            parallel_output(vals, n, rank, nprocs, opts.min_value, opts.output_path);
+    }
+    else if(opts.shm)
+    {
+        // only the node leaders send their node's results across, see shm_output
+        shm_output(&ns, opts.min_value);
+    }
+    else
+    {
+        // each rank knows how many lines it extracted (myCount = n); rank 0 allocates an array
+        // counts[p] to receive all those counts; MPI_Gather collects each rank's line count into
+        // counts[] on rank 0
+        int myCount = (int)n;
+        int *counts = NULL, *displs = NULL;
+        if(!rank)
         {
-            if(c >= 32 && c <= 126 && c > cur)
-                cur = c;
+            counts = malloc(nprocs * sizeof *counts);
         }
-        else
+
+        MPI_Gather(&myCount, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+        // on rank 0 we build a displs[] array of byte-displacements so each rank's set of myCount values
+        // lands in the right place in the output array; we allocate allvals large enough to hold the sum
+        // of all counts; MPI_Gatherv then collects each rank's vals[] into allvals[] on rank 0
+        unsigned char *allvals = NULL;
+        if(!rank)
         {
-            if(n == cap)
+            displs = malloc(nprocs * sizeof *displs);
+            displs[0] = 0;
+            for (int p = 1; p < nprocs; ++p)
+                displs[p] = displs[p-1] + counts[p-1];
+
+            allvals = malloc(displs[nprocs-1] + counts[nprocs-1]);
+            result_bytes += displs[nprocs-1] + counts[nprocs-1];
+        }
+
+        MPI_Gatherv(vals, myCount, MPI_UNSIGNED_CHAR, allvals, counts, displs, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+        t_collect = MPI_Wtime() - t0;
+        t0 = MPI_Wtime();
+
+        // on rank 0, printing the final output and cleaning up by freeing memory
+        if(!rank)
+        {
+            long idx = 0;
+            long total = displs[nprocs-1] + counts[nprocs-1];
+            for (; idx < total; ++idx)
             {
-                cap <<= 1;
-                vals = realloc(vals, cap);
+                // only values at or above --min-value (which defaults to 0) are printed
+                if(allvals[idx] >= opts.min_value)
+                    printf("%ld: %u\n", idx, allvals[idx]);
             }
-            vals[n++] = cur;
-            cur = 0;
+
+            free(allvals);
+            free(counts);
+            free(displs);
         }
     }
-    // final check for leftover line
-    if(cur != 0 || (bytes > 0 && buf[bytes-1] != '\n'))
-    {
-         if(n == cap)
-         {
-             cap <<= 1;
-             vals = realloc(vals, cap);
-         }
-         vals[n++] = cur;
-    }
-    free(buf);
+    t_output = MPI_Wtime() - t0;
+    if(opts.counters)
+        counters_take(&ctr, &phases[PHASE_OUTPUT]);
 
-    // each rank knows how many lines it extracted (myCount = n); rank 0 allocates an array
-    // counts[p] to receive all those counts; MPI_Gather collects each rank's line count into
-    // counts[] on rank 0
-    int myCount = (int)n;
-    int *counts = NULL, *displs = NULL;
-    if(!rank)
+    if(opts.stats)
     {
-        counts = malloc(nprocs * sizeof *counts);
+        fflush(stdout);
+        report_stats(t_scan, t_collect, t_output, rank);
     }
-
-    MPI_Gather(&myCount, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
-
-    // on rank 0 we build a displs[] array of byte-displacements so each rank's set of myCount values
-    // lands in the right place in the output array; we allocate allvals large enough to hold the sum
-    // of all counts; MPI_Gatherv then collects each rank's vals[] into allvals[] on rank 0
-    unsigned char *allvals = NULL;
-    if(!rank)
+    if(opts.counters)
     {
-        displs = malloc(nprocs * sizeof *displs);
-        displs[0] = 0;
-        for (int p = 1; p < nprocs; ++p)
-            displs[p] = displs[p-1] + counts[p-1];
-
-        allvals = malloc(displs[nprocs-1] + counts[nprocs-1]);
+        fflush(stdout);
+        report_counters(phases, rank);
+        counters_close(&ctr);
     }
-
-    MPI_Gatherv(vals, myCount, MPI_UNSIGNED_CHAR, allvals, counts, displs, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
-
-    // on rank 0, printing the final output and cleaning up by freeing memory
-    if(!rank)
+    if(opts.affinity)
     {
-        long idx = 0;
-        long total = displs[nprocs-1] + counts[nprocs-1];
-        for (; idx < total; ++idx)
-            printf("%ld: %u\n", idx, allvals[idx]);
-
-        free(allvals);
-        free(counts);
-        free(displs);
+        fflush(stdout);
+        report_affinity(rank, nprocs);
     }
-    free(vals);
+    if(opts.shm)
+        shm_free(&ns);
+    else
+        free(vals);
+
+    if(io_info != MPI_INFO_NULL)
+        MPI_Info_free(&io_info);
 
     // shuts down the MPI environment cleanly
     MPI_Finalize();
@@ -13,57 +13,95 @@ module load foss/2022a OpenMPI/4.1.4-GCC-11.3.0
 cd "${SLURM_SUBMIT_DIR}"
 
 # compile the mpi version
-mpicc -Wall -O2 MPI.c -o mpi
+mpicc -Wall -O2 MPI.c -o mpi -lm
 
 # ensure it really is executable
 chmod +x mpi
 
-# $1 = size spec (e.g. 60M), $2 = thread count
-# create a temp file with the first $1 bytes of the dump
-dumpfile="dump_${1}.txt"
-head -c "$1" ~dan/625/wiki_dump.txt > "$dumpfile"
+# $1 = size spec (e.g. 60M)
+# --limit-bytes scans only the first $1 bytes of the dump, so no prefix copy is made
+dumpfile=~dan/625/wiki_dump.txt
 
 # params
 size=$1 # e.g. "60M"
 ranks=$SLURM_NTASKS  # e.g. "4"
 
+# $2 = cache mode: warm (the default) reads the input once before every trial, so the trials measure the
+# scan (compute-bound); cold drops the input from the page cache before every trial with
+# posix_fadvise(POSIX_FADV_DONTNEED), which is what dd iflag=nocache does, so they measure reading it (I/O-bound)
+mode=${2:-warm}
+if [[ $mode != warm && $mode != cold ]]; then
+  echo "ERROR: the cache mode must be warm or cold" >&2
+  exit 1
+fi
+
+# cold trials are kept apart from warm ones by their name, e.g. analysis/mpi-cold_720M_8_summary.txt, so the
+# plots draw the I/O-bound and the compute-bound scaling of every backend as separate lines
+impl=mpi
+if [[ $mode == cold ]]; then
+  impl=mpi-cold
+fi
+
 # prepare output files
-out_csv="analysis/mpi_${size}_${ranks}_runs.csv"
-summary_txt="analysis/mpi_${size}_${ranks}_summary.txt"
+out_csv="analysis/${impl}_${size}_${ranks}_runs.csv"
+summary_txt="analysis/${impl}_${size}_${ranks}_summary.txt"
+phases_csv="analysis/${impl}_${size}_${ranks}_phases.csv"
+trials_csv="analysis/${impl}_${size}_${ranks}_trials.csv"
 
 # add a header to the output csv
-echo "run,task_clock_ms,wall_s,cpu_pct,max_rss_kb" > "$out_csv"
+echo "run,task_clock_ms,wall_s,cpu_pct,max_rss_kb,cycles,instructions,llc_misses,branch_misses,dtlb_misses,page_faults" > "$out_csv"
+
+# the per-phase counter rows of every run go into a second csv
+echo "run,phase,task_clock_ms,cycles,instructions,llc_misses,branch_misses,dtlb_misses,page_faults" > "$phases_csv"
+
+# and the cache mode, CPU clock and placement of every trial into a third (cpus lists the CPU of each
+# thread or rank, separated by semicolons)
+echo "run,cache,wall_s,cpu_mhz,cpus" > "$trials_csv"
 
 # loop for N=10 trials so that we can get an average and standard deviation for each combination of input size and core count
 for run in $(seq 1 10); do
-  # perf stat
-  perf_out="analysis/perf_run${run}.csv"
-  perf stat -x, -e task-clock \
-    -o "$perf_out" -- mpirun -np "$ranks" ./mpi "$dumpfile"
-  # grab the first field of the first non-comment line
-  task_clock_ms=$(awk -F, '/^[0-9]/{print $1; exit}' "$perf_out")
-
   # /usr/bin/time for wall clock, CPU%, max RSS
+  # --counters makes the executable report task-clock and the hardware counters itself, so one run
+  # per trial gives both the timing and the counters (perf stat used to need a run of its own)
   time_out="analysis/time_run${run}.txt"
+
+  # puts the input into the page cache state of the mode
+  if [[ $mode == cold ]]; then
+    dd if="$dumpfile" iflag=nocache count=0 status=none
+  else
+    head -c "$size" "$dumpfile" > /dev/null
+  fi
+
+  # --pin keeps every thread (or rank) on its own CPU, --affinity reports where they ran and the clock
   /usr/bin/time -f "WALL=%e\nCPU_PCT=%P\nMAXRSS=%M" \
-  mpirun -np "$ranks" ./mpi "$dumpfile" 2> "$time_out"
+  mpirun --bind-to none -np "$ranks" ./mpi --counters --pin --affinity --limit-bytes="$1" "$dumpfile" 2> "$time_out"
 
-  # pull out values
+  # pull out values; the counters' total row reads counters,total,task_clock_ms,cycles,...,page_faults
+  task_clock_ms=$(awk -F, '/^counters,total,/ {print $3}' "$time_out")
+  counters=$(awk -F, '/^counters,total,/ {print $4","$5","$6","$7","$8","$9}' "$time_out")
+  awk -F, -v run="$run" '/^counters,/ && $2 != "phase" && $2 != "total" {sub(/^counters/, run); print}' \
+    "$time_out" >> "$phases_csv"
   wall_s=$(awk -F= '/^WALL=/ {print $2}' "$time_out")
   cpu_pct=$(awk -F= '/^CPU_PCT=/ {print $2}' "$time_out" | tr -d '%')
   max_rss_kb=$(awk -F= '/^MAXRSS=/ {print $2}' "$time_out")
+  affinity=$(awk -F, '/^affinity,/ {print $3","$2}' "$time_out")
 
   # append to the master csv file
-  echo "$run,$task_clock_ms,$wall_s,$cpu_pct,$max_rss_kb" \
+  echo "$run,$task_clock_ms,$wall_s,$cpu_pct,$max_rss_kb,$counters" \
     >> "$out_csv"
+  echo "$run,$mode,$wall_s,$affinity" >> "$trials_csv"
 done
 
-# remove the dump files
-rm -f "$dumpfile" analysis/perf_run*.csv analysis/time_run*.txt
+# remove the per-run time files
+rm -f analysis/time_run*.txt
 
 # compute statistics (i.e. the mean and standard deviation) for each column using awk
 awk -F, '
+  NR==1 { for(c = 6; c <= NF; c++) name[c]=$c } # names of the counter columns
+
   NR>1 {
+    # counters that the machine lacks are NA and left out of their mean
+    for(c = 6; c <= NF; c++) if($c != "NA") { cn[c]++; cv[c, cn[c]]=$c; cs[c]+=$c }
     tc[NR-1]=$2; # task clock values
     ws[NR-1]=$3; # wall time values
     cp[NR-1]=$4; # CPU% values
@@ -105,5 +143,54 @@ awk -F, '
     printf("wall_s         %.3f s     %.3f s\n",  mean_ws, sd_ws) >> "'"$summary_txt"'"
     printf("cpu_pct        %.1f%%       %.1f%%\n",  mean_cp, sd_cp) >> "'"$summary_txt"'"
     printf("max_rss_kb     %.0f KB     %.0f KB\n",   mean_mr, sd_mr) >> "'"$summary_txt"'"
+
+    # mean and standard deviation of every counter that was available
+    for(c = 6; c in name; c++)
+    {
+      if(!cn[c])
+        continue
+      m = cs[c]/cn[c]; sd = 0
+      for(i = 1; i <= cn[c]; i++)
+        sd += (cv[c, i]-m)^2
+      printf("%-14s %.0f     %.0f\n", name[c], m, sqrt(sd/cn[c])) >> "'"$summary_txt"'"
+    }
   }
 ' "$out_csv"
+
+# flags the trials whose wall time lies more than 3 scaled MADs (the median absolute deviation times
+# 1.4826, which matches a standard deviation for normal noise) from the median, then adds to the summary
+# how many there were, the wall time without them and the mean clock of the CPUs the trials ran on
+awk -F, -v OFS=, -v summary="$summary_txt" '
+  # median of a[1..n], sorting a in place
+  function median(a, n,   i, j, t) {
+    for(i = 2; i <= n; i++)
+      for(j = i; j > 1 && a[j-1] > a[j]; j--) { t = a[j]; a[j] = a[j-1]; a[j-1] = t }
+    return (n % 2) ? a[(n+1)/2] : (a[n/2] + a[n/2+1]) / 2
+  }
+
+  # first pass: collect the wall times
+  NR == FNR { if(FNR > 1) { n = FNR-1; w[n] = $3; s[n] = $3 } next }
+
+  # second pass: add the outlier column
+  FNR == 1 {
+    med = median(s, n)
+    for(i = 1; i <= n; i++) d[i] = (w[i] > med) ? w[i]-med : med-w[i]
+    lim = 3 * 1.4826 * median(d, n)
+    print $0, "outlier"
+    next
+  }
+  {
+    out = (lim > 0 && (($3 > med) ? $3-med : med-$3) > lim)
+    print $0, out
+    if(out) nout++
+    else { kn++; ks += $3; kq += $3*$3 }
+    if($4 != "NA") { fn++; fs += $4; fq += $4*$4 }
+  }
+
+  END {
+    m = ks/kn; v = kq/kn - m*m
+    printf("wall_s_inliers %.3f s     %.3f s\n", m, sqrt(v > 0 ? v : 0)) >> summary
+    if(fn) { m = fs/fn; v = fq/fn - m*m; printf("cpu_mhz        %.0f MHz   %.0f MHz\n", m, sqrt(v > 0 ? v : 0)) >> summary }
+    printf("outliers       %d of %d\n", nout, n) >> summary
+  }
+' "$trials_csv" "$trials_csv" > "$trials_csv.tmp" && mv "$trials_csv.tmp" "$trials_csv"
@@ -12,30 +12,36 @@ sizes=(60M 120M 240M 720M 1440M 1700M)
 # list of ranks to test
 cores=(1 2 4 8 16 20)
 
+# page cache states: warm trials measure the scan (compute-bound), cold trials reading the input from
+# disk (I/O-bound), see the cache mode parameter of the script
+modes=(warm cold)
+
 last_jid=""
 
-for sz in "${sizes[@]}"; do
-  for rk in "${cores[@]}"; do
-    # generate a distinctive job name
-    jobname="mpi_${sz}_${rk}"
+for mode in "${modes[@]}"; do
+  for sz in "${sizes[@]}"; do
+    for rk in "${cores[@]}"; do
+      # generate a distinctive job name
+      jobname="mpi_${mode}_${sz}_${rk}"
 
-    sbatch_cmd=( sbatch
-      --job-name="$jobname"
-      --ntasks="$rk"
-      --cpus-per-task=1
-      --output="logs/slurm_${sz}_${rk}.out"
-    )
+      sbatch_cmd=( sbatch
+        --job-name="$jobname"
+        --ntasks="$rk"
+        --cpus-per-task=1
+        --output="logs/slurm_${mode}_${sz}_${rk}.out"
+      )
 
-    # if this isn’t the first job, add the dependency
-    if [[ -n $last_jid ]]; then
-      sbatch_cmd+=( --dependency=afterok:"$last_jid" )
-    fi
+      # if this isn’t the first job, add the dependency
+      if [[ -n $last_jid ]]; then
+        sbatch_cmd+=( --dependency=afterok:"$last_jid" )
+      fi
 
-    sbatch_cmd+=( mpi_script.sh "$sz" )
+      sbatch_cmd+=( mpi_script.sh "$sz" "$mode" )
 
-    # launch and capture the new job’s ID
-    jid=$("${sbatch_cmd[@]}" | awk '{print $4}')
-    last_jid=$jid
+      # launch and capture the new job’s ID
+      jid=$("${sbatch_cmd[@]}" | awk '{print $4}')
+      last_jid=$jid
 
+    done
   done
 done
@@ -0,0 +1,36 @@
+#!/bin/bash
+# checks that --follow ends when the followed file is removed or renamed: a line is appended while the
+# file is followed, then the file goes away, and the run must exit on its own (within a timeout) with
+# the appended line counted in its --summary
+#
+# usage: ./follow_test.sh [openmp executable]    (run by ctest with the built one)
+
+# if any command in this script returns a non-zero (i.e. “error”) exit status, immediately stop the script
+set -e
+
+exe=$(realpath "${1:-./openmp}")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# $1 is the command that makes the followed file go away
+check() {
+  printf 'abc\nxyz\n' > "$dir/in.txt"
+  # the openmp executable exits with 1 on success; timeout exits with 124 if it's still following
+  OMP_NUM_THREADS=2 timeout 10 "$exe" --follow --summary "$dir/in.txt" > "$dir/out.txt" &
+  local pid=$!
+  sleep 1
+  printf 'hello~\n' >> "$dir/in.txt"
+  sleep 0.5
+  eval "$1"
+  local rc=0
+  wait $pid || rc=$?
+  if [[ $rc != 1 ]] || ! grep -qx 'lines: 3' "$dir/out.txt" || ! grep -qx '126: 1' "$dir/out.txt"; then
+    echo "FAIL: $1 (exit status $rc)"
+    cat "$dir/out.txt"
+    exit 1
+  fi
+  echo "ok: $1"
+}
+
+check 'rm "$dir/in.txt"'
+check 'mv "$dir/in.txt" "$dir/moved.txt"'
@@ -1,23 +1,915 @@
+// sched_getcpu and the CPU_SET macros used by common/affinity.h are GNU extensions
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdint.h>
 #include <sys/mman.h>
 #include <omp.h>
 
+#include "../common/affinity.h"
+#include "../common/approx.h"
+#include "../common/aggregate.h"
+#include "../common/counters.h"
+#include "../common/digest.h"
+#include "../common/kernel.h"
+#include "../common/lineindex.h"
+#include "../common/options.h"
+#include "../common/outbuf.h"
+#include "../common/stream.h"
+#include "../common/tune.h"
+#include "../common/xml.h"
+
+// --auto-tune calibrates on at most this many bytes from the start of the input, timing every
+// configuration TUNE_REPS times and keeping the fastest run
+#define TUNE_SAMPLE (64 << 20)
+#define TUNE_REPS 3
+
+// --counters splits the run into these phases; in the aggregate (--summary, --top-k, --digest) and
+// --parallel-output modes the per-line scan happens while the output is produced, so it's counted under output
+enum { PHASE_LOAD, PHASE_INDEX, PHASE_SCAN, PHASE_OUTPUT, NPHASES };
+static const char *const phase_names[NPHASES] = { "load", "index", "scan", "output" };
+
+// --counters: every thread of the team opens its own counters; the OpenMP runtime keeps the same threads
+// for every parallel region, so the main thread can read all of them between phases
+static struct counters *open_thread_counters(void)
+{
+    struct counters *ctr = malloc(omp_get_max_threads() * sizeof *ctr);
+    if (!ctr)
+        return NULL;
+    #pragma omp parallel num_threads(omp_get_max_threads())
+    counters_open(&ctr[omp_get_thread_num()]);
+    return ctr;
+}
+
+// --pin: pins every thread of the team to its own CPU; like the counters, this relies on the runtime
+// keeping the same threads for every parallel region
+static void pin_threads(void)
+{
+    #pragma omp parallel num_threads(omp_get_max_threads())
+    affinity_pin(omp_get_thread_num());
+}
+
+// --affinity: reports the CPU every thread of the team is on once the work is done, and their clock
+static void report_affinity(void)
+{
+    int n = omp_get_max_threads();
+    int *cpus = malloc(n * sizeof *cpus);
+    double *mhz = malloc(n * sizeof *mhz);
+    if (cpus && mhz)
+    {
+        #pragma omp parallel num_threads(n)
+        {
+            int t = omp_get_thread_num();
+            cpus[t] = sched_getcpu();
+            mhz[t] = affinity_cpu_mhz(cpus[t]);
+        }
+        fflush(stdout);
+        affinity_report(cpus, mhz, n);
+    }
+    free(cpus);
+    free(mhz);
+}
+
+// ends a phase: adds what every thread counted since the previous phase ended to its totals
+static void end_phase(struct counters *ctr, struct counter_totals *phase)
+{
+    if (!ctr)
+        return;
+    for (int t = 0; t < omp_get_max_threads(); ++t)
+        counters_take(&ctr[t], phase);
+}
+
+// --class: the byte class the lines' maxima are taken over, the printable bytes (32-126) by default
+static struct byte_class line_class;
+
+// maximum value of one long line [p, e) in the class, scanned as a taskloop over pieces of
+// SPLIT_PIECE_BYTES: threads that are done with their own lines (or waiting at a barrier) pick up pieces
+// while the thread the line belongs to works through the rest, and the pieces' maxima are combined with
+// a max reduction; once a piece finds the class's top value (a '~' for printable) the remaining ones are skipped
+static unsigned split_line_max(const char *p, const char *e)
+{
+    size_t npieces = ((size_t)(e - p) + SPLIT_PIECE_BYTES - 1) / SPLIT_PIECE_BYTES;
+    unsigned m = 0;
+    int saturated = 0;
+
+    #pragma omp taskloop grainsize(1) reduction(max:m) shared(saturated)
+    for (size_t k = 0; k < npieces; ++k)
+    {
+        const char *a = p + k * SPLIT_PIECE_BYTES;
+        const char *b = ((size_t)(e - a) > SPLIT_PIECE_BYTES) ? a + SPLIT_PIECE_BYTES : e;
+#ifndef NO_SHORT_CIRCUIT
+        int done;
+        #pragma omp atomic read
+        done = saturated;
+        if (done)
+            continue;
+#endif
+        unsigned v = line_max_in_class(&line_class, a, b);
+        if (v > m)
+            m = v;
+        if (v == line_class.top)
+        {
+            #pragma omp atomic write
+            saturated = 1;
+        }
+    }
+    return m;
+}
+
+// --xml: the content regions of the chosen elements in the buffer being scanned (see find_content), or
+// NULL to scan every byte of every line
+static const struct xml_regions *xml_content;
+
+// --xml version of compute_range: a line's maximum only covers its bytes that lie in a content region,
+// so each line is clipped against the regions overlapping it, and lines outside every region get 0;
+// the regions are sorted, so the first one is found by binary search and the rest are walked alongside
+// the lines
+static void compute_range_xml(const struct line_index *idx, const struct xml_regions *rs, unsigned char *maxval,
+                              size_t lo, size_t hi)
+{
+    struct line_cursor cur;
+    size_t s, e;
+    lineidx_cursor_init(&cur, idx, lo);
+    size_t k = xml_first_region(rs, cur.start);
+    for (size_t i = lo; i < hi; ++i)
+    {
+        unsigned m = 0;
+        lineidx_next(&cur, &s, &e);
+        for (; k < rs->n && rs->r[k].start < e; ++k)
+        {
+            size_t a = rs->r[k].start > s ? rs->r[k].start : s;
+            size_t b = rs->r[k].end < e ? rs->r[k].end : e;
+            if (a < b)
+            {
+                unsigned v = (b - a > SPLIT_LINE_BYTES) ? split_line_max(idx->buf + a, idx->buf + b)
+                                                        : line_max_in_class(&line_class, idx->buf + a, idx->buf + b);
+                if (v > m)
+                    m = v;
+            }
+            // a region that runs on past the line carries over to the next one
+            if (rs->r[k].end > e)
+                break;
+        }
+        maxval[i] = (unsigned char)m;
+    }
+}
+
+// computes the maximum value in byte class id (by default the printable ASCII values, 32-126) of lines
+// [lo, hi), walking the line index from lo onwards; line_max_class stops scanning a line as soon as its
+// maximum can't rise any further, and lines longer than SPLIT_LINE_BYTES are shared out among the
+// threads, see split_line_max; id is a constant wherever this is inlined, so each class gets its own loop
+CLASS_KERNEL void compute_range_class(int id, const struct line_index *idx, unsigned char *maxval, size_t lo,
+                                      size_t hi)
+{
+    struct line_cursor cur;
+    size_t s, e;
+    lineidx_cursor_init(&cur, idx, lo);
+    for (size_t i = lo; i < hi; ++i)
+    {
+        lineidx_next(&cur, &s, &e);
+        if (e - s > SPLIT_LINE_BYTES)
+            maxval[i] = (unsigned char)split_line_max(idx->buf + s, idx->buf + e);
+        else
+            maxval[i] = (unsigned char)line_max_class(id, &line_class, idx->buf + s, idx->buf + e);
+    }
+}
+
+// computes the maxima of lines [lo, hi) with the kernel of the chosen class, or over the content of the
+// --xml elements only
+static void compute_range(const struct line_index *idx, unsigned char *maxval, size_t lo, size_t hi)
+{
+    if (xml_content)
+    {
+        compute_range_xml(idx, xml_content, maxval, lo, hi);
+        return;
+    }
+    switch (line_class.id)
+    {
+    case CLASS_PRINTABLE:
+        compute_range_class(CLASS_PRINTABLE, idx, maxval, lo, hi);
+        break;
+    case CLASS_ASCII:
+        compute_range_class(CLASS_ASCII, idx, maxval, lo, hi);
+        break;
+    case CLASS_ALNUM:
+        compute_range_class(CLASS_ALNUM, idx, maxval, lo, hi);
+        break;
+    case CLASS_LETTERS:
+        compute_range_class(CLASS_LETTERS, idx, maxval, lo, hi);
+        break;
+    default:
+        compute_range_class(CLASS_SET, idx, maxval, lo, hi);
+        break;
+    }
+}
+
+// computes every line's maximum on nthreads threads: with chunk_lines == 0 each thread takes one
+// contiguous range of lines (just like schedule(static) would), otherwise the lines are handed out in
+// chunks of chunk_lines lines as threads become free (schedule(dynamic)), which evens out inputs whose
+// long lines are bunched together
+static void compute_all(const struct line_index *idx, unsigned char *maxval, int nthreads, size_t chunk_lines)
+{
+    size_t nlines = idx->nlines;
+    if (!chunk_lines)
+    {
+        #pragma omp parallel num_threads(nthreads)
+        {
+            int t = omp_get_thread_num();
+            int nt = omp_get_num_threads();
+            compute_range(idx, maxval, nlines * t / nt, nlines * (t + 1) / nt);
+        }
+        return;
+    }
+
+    size_t nchunks = (nlines + chunk_lines - 1) / chunk_lines;
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for (size_t c = 0; c < nchunks; ++c)
+    {
+        size_t lo = c * chunk_lines;
+        compute_range(idx, maxval, lo, (nlines - lo < chunk_lines) ? nlines : lo + chunk_lines);
+    }
+}
+
+// --io=read: reads the file into a heap buffer, every thread filling its own share of the bytes with
+// pread, instead of mapping it and taking a page fault per page during the scan; returns NULL on failure
+static char *read_parallel(int fd, size_t filesize)
+{
+    char *buf = malloc(filesize);
+    int failed = 0;
+    if (!buf)
+    {
+        fprintf(stderr, "Allocation failure\n");
+        return NULL;
+    }
+
+    #pragma omp parallel
+    {
+        int t = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+        size_t lo = filesize * t / nt;
+        size_t hi = filesize * (t + 1) / nt;
+
+        // pread may return fewer bytes than asked for (at most 2 GiB per call on Linux)
+        while (lo < hi)
+        {
+            ssize_t r = pread(fd, buf + lo, hi - lo, (off_t)lo);
+            if (r <= 0)
+            {
+                if (r < 0)
+                    perror("pread");
+                #pragma omp atomic write
+                failed = 1;
+                break;
+            }
+            lo += (size_t)r;
+        }
+    }
+
+    if (failed)
+    {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+// makes the first size bytes of the file available in memory, mapped or read (see read_parallel);
+// returns NULL on failure
+static char *load_input(int fd, size_t size, int io_read)
+{
+    if (io_read)
+        return read_parallel(fd, size);
+
+    // maps the file to memory, as suggested by https://hpc-tutorials.llnl.gov/openmp/
+    // reports an error if one occurred; protection is set to read only, MAP_PRIVATE
+    // flag indicates writes made to the mapped memory aren't visible to the underlying
+    // file and won't be seen by other processes mapping the same file
+    char *buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buf == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+    return buf;
+}
+
+static void release_input(char *buf, size_t size, int io_read)
+{
+    if (io_read)
+        free(buf);
+    else
+        munmap(buf, size);
+}
+
+// times the per-line scan of the sample, best of TUNE_REPS runs
+static double time_scan(const struct line_index *idx, unsigned char *maxval, int nthreads, size_t chunk_lines)
+{
+    double best = 0;
+    for (int rep = 0; rep < TUNE_REPS; ++rep)
+    {
+        double t0 = omp_get_wtime();
+        compute_all(idx, maxval, nthreads, chunk_lines);
+        double t = omp_get_wtime() - t0;
+        if (!rep || t < best)
+            best = t;
+    }
+    return best;
+}
+
+// keeps the page-touching loop in time_io from being optimized away
+static volatile unsigned long tune_sink;
+
+// times loading the first size bytes with the given I/O mode and touching every page as the scan
+// would, best of TUNE_REPS runs; returns a negative time if loading failed
+static double time_io(int fd, size_t size, int io_read)
+{
+    double best = 0;
+    for (int rep = 0; rep < TUNE_REPS; ++rep)
+    {
+        double t0 = omp_get_wtime();
+        char *buf = load_input(fd, size, io_read);
+        if (!buf)
+            return -1;
+        unsigned long sum = 0;
+        #pragma omp parallel for reduction(+:sum)
+        for (size_t i = 0; i < size; i += 4096)
+            sum += (unsigned char)buf[i];
+        double t = omp_get_wtime() - t0;
+        tune_sink = sum;
+        release_input(buf, size, io_read);
+        if (!rep || t < best)
+            best = t;
+    }
+    return best;
+}
+
+// --auto-tune calibration on a line-aligned sample from the start of the input: the scan is timed for
+// every candidate thread count from the machine's topology (see tune_thread_candidates) with one range
+// per thread, then for a few chunk sizes at the chosen count (if it's more than one), and finally mmap
+// is compared with pread at that count; more threads, a dynamic schedule or pread are only picked when
+// they're TUNE_MIN_GAIN faster than the simpler choice; returns 0 on success
+static int calibrate(int fd, size_t filesize, struct tune_choice *best)
+{
+    static const size_t chunks[] = { 1024, 16384, 262144 };
+    size_t sample = filesize < TUNE_SAMPLE ? filesize : TUNE_SAMPLE;
+    char *buf = load_input(fd, sample, 0);
+    if (!buf)
+        return -1;
+
+    // cuts the sample after its last newline so it only holds whole lines
+    size_t len = sample;
+    while (len > 0 && buf[len - 1] != '\n')
+        len--;
+    if (len == 0)
+        len = sample;
+
+    struct line_index idx;
+    unsigned char *maxval = NULL;
+    if (lineidx_build(&idx, buf, len) != 0 || !(maxval = malloc(idx.nlines ? idx.nlines : 1)))
+    {
+        fprintf(stderr, "Allocation failure\n");
+        release_input(buf, sample, 0);
+        return -1;
+    }
+
+    int cand[TUNE_MAX_CANDIDATES];
+    int ncand = tune_thread_candidates(omp_get_num_procs(), cand);
+    double best_time = 0;
+    best->threads = 1;
+    best->chunk_lines = 0;
+    best->io_read = 0;
+    for (int i = 0; i < ncand; ++i)
+    {
+        double t = time_scan(&idx, maxval, cand[i], 0);
+        if (!i || t < best_time * (1 - TUNE_MIN_GAIN))
+        {
+            best_time = t;
+            best->threads = cand[i];
+        }
+    }
+    // a single thread has nobody to balance against
+    for (size_t i = 0; best->threads > 1 && i < sizeof chunks / sizeof chunks[0]; ++i)
+    {
+        double t = time_scan(&idx, maxval, best->threads, chunks[i]);
+        if (t < best_time * (1 - TUNE_MIN_GAIN))
+        {
+            best_time = t;
+            best->chunk_lines = chunks[i];
+        }
+    }
+
+    lineidx_free(&idx);
+    free(maxval);
+    release_input(buf, sample, 0);
+
+    omp_set_num_threads(best->threads);
+    double t_map = time_io(fd, sample, 0);
+    double t_read = time_io(fd, sample, 1);
+    best->io_read = t_map >= 0 && t_read >= 0 && t_read < t_map * (1 - TUNE_MIN_GAIN);
+    return 0;
+}
+
+// --auto-tune: takes the thread count, chunk size and I/O mode from the host's profile entry for this
+// backend and input size class; without one (or with --retune) they're calibrated and saved, so later
+// runs on inputs of about the same size start straight away; the choice replaces --chunk-lines and --io
+static void auto_tune(int fd, size_t filesize, struct run_options *opts)
+{
+    char path[4096];
+    struct tune_choice c;
+    int cls = tune_size_class(filesize);
+    const char *how = "profile";
+
+    tune_profile_path(path, sizeof path, opts->tune_profile);
+    if (opts->retune || tune_profile_load(path, "openmp", cls, &c) != 0)
+    {
+        if (calibrate(fd, filesize, &c) != 0)
+            return;
+        how = "calibrated";
+        tune_profile_save(path, "openmp", cls, &c);
+    }
+
+    omp_set_num_threads(c.threads);
+    opts->chunk_lines = c.chunk_lines;
+    opts->io_read = c.io_read;
+    fprintf(stderr, "auto-tune (%s, %s): %d threads, chunk %zu lines%s, io %s\n", how, path, c.threads,
+            c.chunk_lines, c.chunk_lines ? "" : " (static)", c.io_read ? "read" : "mmap");
+}
+
+// builds the compact line index in parallel: every thread counts the newlines in its share of the
+// bytes, the counts are prefix-summed so each thread knows the number of its first line, and then
+// every thread records the ends of its own lines; returns 0 on success
+static int build_index(struct line_index *idx, const char *buf, size_t filesize)
+{
+    int nthreads = omp_get_max_threads();
+    size_t *first = malloc((nthreads + 1) * sizeof *first);
+    int failed = 0;
+    if (!first)
+        return -1;
+
+    #pragma omp parallel num_threads(nthreads)
+    {
+        int t = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+        size_t lo = filesize * t / nt;
+        size_t hi = filesize * (t + 1) / nt;
+
+        first[t + 1] = lineidx_count(buf, lo, hi);
+        #pragma omp barrier
+        #pragma omp single
+        {
+            first[0] = 0;
+            for (int i = 0; i < nt; ++i)
+                first[i + 1] += first[i];
+            failed = lineidx_alloc(idx, buf, filesize, first[nt]) != 0;
+        }
+        if (!failed)
+            lineidx_fill(idx, lo, hi, first[t]);
+    }
+
+    free(first);
+    return failed ? -1 : 0;
+}
+
+// --xml, the structural pass: every thread looks for the start tags of the chosen elements in its share
+// of the bytes with the block masks of xml_find_regions and collects the regions of their content, and
+// the threads' lists are joined in thread order, which leaves them sorted; in_content says the buffer
+// starts inside the content of an element that began in an earlier batch of a stream; returns 0 on success
+static int find_content(const struct xml_filter *filter, const char *buf, size_t size, int in_content,
+                        struct xml_regions *out)
+{
+    int nthreads = omp_get_max_threads();
+    struct xml_regions *parts = calloc(nthreads, sizeof *parts);
+    int failed = 0;
+    if (!parts)
+        return -1;
+
+    #pragma omp parallel num_threads(nthreads)
+    {
+        int t = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+        size_t lo = size * t / nt;
+        size_t hi = size * (t + 1) / nt;
+
+        // the content carried over from the previous batch ends at the first tag
+        if (t == 0 && in_content)
+        {
+            const char *lt = memchr(buf, '<', size);
+            size_t end = lt ? (size_t)(lt - buf) : size;
+            if (end && xml_regions_add(&parts[0], 0, end) != 0)
+            {
+                #pragma omp atomic write
+                failed = 1;
+            }
+        }
+        if (xml_find_regions(filter, buf, size, lo, hi, &parts[t]) != 0)
+        {
+            #pragma omp atomic write
+            failed = 1;
+        }
+    }
+
+    size_t n = 0;
+    for (int t = 0; t < nthreads; ++t)
+        n += parts[t].n;
+    out->r = failed ? NULL : malloc((n ? n : 1) * sizeof *out->r);
+    out->n = out->cap = 0;
+    if (out->r)
+    {
+        for (int t = 0; t < nthreads; ++t)
+        {
+            if (parts[t].n)
+                memcpy(out->r + out->n, parts[t].r, parts[t].n * sizeof *out->r);
+            out->n += parts[t].n;
+        }
+        out->cap = n;
+    }
+    for (int t = 0; t < nthreads; ++t)
+        xml_regions_free(&parts[t]);
+    free(parts);
+    return out->r ? 0 : -1;
+}
+
+// parallel output mode: every thread takes one contiguous range of lines, computes their maxima and
+// immediately formats its "N: V" records into a private buffer; the buffers are then written in order
+// with writev to out_fd, or copied in parallel into a pre-sized mmap'd output file at their prefix-summed
+// offsets when output_path is given; only lines whose value is at least min_value are written; the index's
+// lines are numbered from first_line on, which is only non-zero for the batches of a stream
+static int parallel_output(const struct line_index *idx, unsigned char *maxval, size_t first_line,
+                           unsigned min_value, const char *output_path, int out_fd)
+{
+    size_t nlines = idx->nlines;
+    int nthreads = omp_get_max_threads();
+    struct out_buffer *out = calloc(nthreads, sizeof *out);
+    size_t *offset = malloc((nthreads + 1) * sizeof *offset);
+    int failed = 0;
+    if (!out || !offset)
+    {
+        fprintf(stderr, "Allocation failure\n");
+        free(out);
+        free(offset);
+        return -1;
+    }
+
+    #pragma omp parallel num_threads(nthreads)
+    {
+        int t = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+        size_t lo = nlines * t / nt;
+        size_t hi = nlines * (t + 1) / nt;
+
+        if (out_buffer_init(&out[t], hi - lo) != 0)
+        {
+            #pragma omp atomic write
+            failed = 1;
+        }
+        else
+        {
+            compute_range(idx, maxval, lo, hi);
+            for (size_t i = lo; i < hi; ++i)
+            {
+                if (maxval[i] >= min_value)
+                    out_append(&out[t], first_line + i, maxval[i]);
+            }
+        }
+    }
+
+    int rc = 0;
+    if (failed)
+    {
+        fprintf(stderr, "Allocation failure\n");
+        rc = -1;
+    }
+    else if (output_path)
+    {
+        // each thread's bytes land right after the bytes of every lower-numbered thread
+        offset[0] = 0;
+        for (int t = 0; t < nthreads; ++t)
+            offset[t + 1] = offset[t] + out[t].len;
+
+        char *map;
+        if (out_file_map(output_path, offset[nthreads], &map) != 0)
+        {
+            rc = -1;
+        }
+        else if (map)
+        {
+            #pragma omp parallel for schedule(static, 1) num_threads(nthreads)
+            for (int t = 0; t < nthreads; ++t)
+                memcpy(map + offset[t], out[t].data, out[t].len);
+            munmap(map, offset[nthreads]);
+        }
+    }
+    else
+    {
+        rc = write_buffers_ordered(out_fd, out, nthreads);
+    }
+
+    for (int t = 0; t < nthreads; ++t)
+        free(out[t].data);
+    free(out);
+    free(offset);
+    return rc;
+}
+
+// aggregate modes (--summary, --top-k, --digest): every thread computes its range of lines and folds the
+// values into a private histogram, top-K heap and digest; the histograms and heaps are merged into hist
+// and top once a thread is done, the digests in thread order after the parallel region since the digest
+// depends on the order of the lines; only lines whose value is at least min_value are counted; the
+// index's lines are numbered from first_line on, so a stream's batches can be added up one after the other
+static int aggregate(const struct line_index *idx, unsigned char *maxval, size_t first_line,
+                     const struct run_options *opts, struct histogram *hist, struct topk *top,
+                     struct digest *dg)
+{
+    size_t nlines = idx->nlines;
+    int failed = 0, nthreads = 1;
+    struct digest *parts = malloc(omp_get_max_threads() * sizeof *parts);
+    if (!parts)
+    {
+        fprintf(stderr, "Allocation failure\n");
+        return -1;
+    }
+
+    #pragma omp parallel
+    {
+        int t = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+        size_t lo = nlines * t / nt;
+        size_t hi = nlines * (t + 1) / nt;
+
+        struct histogram local_hist;
+        struct topk local_top;
+        hist_init(&local_hist);
+        digest_init(&parts[t]);
+        if (t == 0)
+            nthreads = nt;
+        if (topk_init(&local_top, opts->top_k) != 0)
+        {
+            #pragma omp atomic write
+            failed = 1;
+        }
+        else
+        {
+            compute_range(idx, maxval, lo, hi);
+            for (size_t i = lo; i < hi; ++i)
+            {
+                if (maxval[i] < opts->min_value)
+                    continue;
+                hist_add(&local_hist, maxval[i]);
+                topk_push(&local_top, maxval[i], first_line + i);
+                if (opts->digest)
+                    digest_add(&parts[t], first_line + i, maxval[i]);
+            }
+
+            // sum up the partial results into the shared ones
+            #pragma omp critical
+            {
+                hist_merge(hist, &local_hist);
+                topk_merge(top, &local_top);
+            }
+            topk_free(&local_top);
+        }
+    }
+
+    for (int t = 0; t < nthreads; ++t)
+        digest_merge(dg, &parts[t]);
+    free(parts);
+
+    if (failed)
+        fprintf(stderr, "Allocation failure\n");
+    return failed ? -1 : 0;
+}
+
+// prints what the aggregate modes collected
+static void print_aggregate(const struct run_options *opts, const struct histogram *hist, struct topk *top,
+                            const struct digest *dg)
+{
+    if (opts->summary)
+        hist_print(hist);
+    if (opts->top_k)
+        topk_print(top);
+    if (opts->digest)
+        digest_print(dg);
+}
+
+// streaming mode for stdin ("-") and pipes, which can't be mapped: the input is read in batches of whole
+// lines into one recycled buffer (see common/stream.h), and every batch is indexed, scanned and written
+// out like a whole file before the next one is read, so results flow before the input ends; line numbers
+// carry on from one batch to the next, and so does the content of an --xml element (filter, NULL
+// otherwise) that's still open at the end of a batch; with follow set (--follow on a regular file, NULL
+// otherwise) the file at that path is read the same way, but its end only ends a batch, see stream_follow,
+// so each append is scanned on its own and numbered after everything before it; returns 0 on success
+static int process_stream(int fd, const struct run_options *opts, const struct xml_filter *filter,
+                          const char *follow)
+{
+    struct line_stream ls;
+    struct histogram hist;
+    struct topk top;
+    struct digest dg;
+    unsigned char *maxval = NULL;
+    size_t maxcap = 0, first_line = 0;
+    int aggregating = opts->summary || opts->top_k || opts->digest;
+    int out_fd = STDOUT_FILENO, rc = 0, in_content = 0;
+    const char *batch;
+    long long len = 0;
+
+    hist_init(&hist);
+    digest_init(&dg);
+    if (stream_init(&ls, fd, opts->slab_size, opts->limit_bytes) != 0 || topk_init(&top, opts->top_k) != 0)
+    {
+        fprintf(stderr, "Allocation failure\n");
+        stream_free(&ls);
+        return -1;
+    }
+    if (follow && stream_follow(&ls, follow) != 0)
+    {
+        topk_free(&top);
+        stream_free(&ls);
+        return -1;
+    }
+
+    // a stream's output size isn't known up front, so --output gets every batch appended with writev
+    // instead of being mapped
+    if (!aggregating && opts->output_path)
+    {
+        out_fd = open(opts->output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0)
+        {
+            perror("open output");
+            rc = -1;
+        }
+    }
+
+    while (rc == 0 && (len = stream_next(&ls, &batch)) > 0)
+    {
+        struct line_index idx;
+        if (build_index(&idx, batch, (size_t)len) != 0)
+        {
+            fprintf(stderr, "Allocation failure\n");
+            rc = -1;
+            break;
+        }
+
+        // a tag split between two batches isn't recognized, but batches end at a newline and tags hardly
+        // ever span lines
+        struct xml_regions regions;
+        if (filter)
+        {
+            if (find_content(filter, batch, (size_t)len, in_content, &regions) != 0)
+            {
+                fprintf(stderr, "Allocation failure\n");
+                lineidx_free(&idx);
+                rc = -1;
+                break;
+            }
+            in_content = regions.n && regions.r[regions.n - 1].end == (size_t)len;
+            xml_content = &regions;
+        }
+
+        // the values array is recycled too, and only grows for a batch with more lines
+        if (idx.nlines > maxcap)
+        {
+            free(maxval);
+            maxcap = idx.nlines;
+            if (!(maxval = malloc(maxcap)))
+            {
+                fprintf(stderr, "Allocation failure\n");
+                lineidx_free(&idx);
+                if (filter)
+                    xml_regions_free(&regions);
+                rc = -1;
+                break;
+            }
+        }
+
+        if (aggregating)
+            rc = aggregate(&idx, maxval, first_line, opts, &hist, &top, &dg);
+        else if (opts->parallel_output)
+            rc = parallel_output(&idx, maxval, first_line, opts->min_value, NULL, out_fd);
+        else
+        {
+            compute_all(&idx, maxval, omp_get_max_threads(), opts->chunk_lines);
+            for (size_t i = 0; i < idx.nlines; ++i)
+            {
+                if (maxval[i] >= opts->min_value)
+                    printf("%zu: %d\n", first_line + i, maxval[i]);
+            }
+            fflush(stdout);
+        }
+        first_line += idx.nlines;
+        lineidx_free(&idx);
+        if (filter)
+            xml_regions_free(&regions);
+        xml_content = NULL;
+    }
+    if (len < 0)
+        rc = -1;
+
+    if (aggregating && rc == 0)
+        print_aggregate(opts, &hist, &top, &dg);
+    if (out_fd != STDOUT_FILENO && out_fd >= 0)
+        close(out_fd);
+    topk_free(&top);
+    free(maxval);
+    stream_free(&ls);
+    return rc;
+}
+
+// --approx: the threads share out the sampled blocks, each read with pread into the thread's own buffer
+// so nothing is mapped, and their counts are folded into per-thread sums that are added up at the end
+static int process_approx(int fd, size_t filesize, const struct run_options *opts)
+{
+    struct approx_plan pl;
+    if (approx_plan_init(&pl, filesize, opts->approx, opts->approx_seed) != 0)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    struct approx_sums total;
+    approx_sums_init(&total);
+    int failed = 0;
+    #pragma omp parallel
+    {
+        struct approx_sums sums;
+        unsigned long long counts[APPROX_VARS];
+        approx_sums_init(&sums);
+        char *buf = malloc(pl.block + 1 > APPROX_TAIL ? pl.block + 1 : APPROX_TAIL);
+        if (!buf)
+        {
+            #pragma omp atomic write
+            failed = 1;
+        }
+
+        #pragma omp for schedule(dynamic)
+        for (size_t i = 0; i < pl.nread; ++i)
+        {
+            if (!buf)
+                continue;
+            if (approx_block_counts(fd, &pl, filesize, pl.sampled[i], &line_class, opts->min_value, buf,
+                                    counts) != 0)
+            {
+                #pragma omp atomic write
+                failed = 1;
+                continue;
+            }
+            approx_sums_add(&sums, &pl, pl.sampled[i], counts);
+        }
+
+        #pragma omp critical
+        approx_sums_merge(&total, &sums);
+        free(buf);
+    }
+
+    if (!failed)
+        approx_print(&pl, &total, filesize);
+    approx_plan_free(&pl);
+    return failed ? -1 : 0;
+}
+
+// prints the --counters report: the counts of every phase, summed over the threads
+static void report_counters(struct counters *ctr, const struct counter_totals *phases)
+{
+    fflush(stdout);
+    counters_report(phase_names, phases, NPHASES);
+    for (int t = 0; t < omp_get_max_threads(); ++t)
+        counters_close(&ctr[t]);
+    free(ctr);
+}
+
 int main(int argc, char *argv[])
 {
-    // ensures there is only one argument after the executable: the file path
-    if (argc != 2)
+    // ensures there is only one argument after the executable and its options: the file path
+    struct run_options opts;
+    const char *args[1] = { NULL };
+    if (parse_options(argc, argv, BACKEND_OPENMP, &opts, args, 1) != 1)
+    {
+        fprintf(stderr, "Usage: %s [options] <filename>\n", argv[0]);
+        print_options_usage();
+        return 0;
+    }
+    const char *path = args[0];
+
+    // --xml: the element names are checked before anything is read
+    struct xml_filter filter;
+    if (opts.xml && xml_filter_init(&filter, opts.xml) != 0)
     {
-        fprintf(stderr, "Usage: %s <filename>\n", argv[0]);
+        fprintf(stderr, "Invalid element list: %s\n", opts.xml);
         return 0;
     }
-    const char *path = argv[1];
 
-    // calls open in read only mode and reports an error if one occurred
-    int fd = open(path, O_RDONLY);
+    // --class: the byte class the maxima are taken over, printable unless another one is given
+    if (byte_class_init(&line_class, opts.byte_class) != 0)
+    {
+        fprintf(stderr, "Invalid byte class: %s\n", opts.byte_class);
+        return 0;
+    }
+
+    // calls open in read only mode ("-" is standard input) and reports an error if one occurred
+    int fd = strcmp(path, "-") ? open(path, O_RDONLY) : STDIN_FILENO;
     if (fd < 0)
     {
         perror("open");
@@ -32,7 +924,45 @@ int main(int argc, char *argv[])
         close(fd);
         return 0;
     }
+    // pipes and the like can't be mapped and are read in batches instead, see process_stream, and so is
+    // a file that's still being written (--follow); everything in a stream counts as the scan phase
+    if (opts.approx && (!S_ISREG(st.st_mode) || opts.follow))
+    {
+        fprintf(stderr, "--approx needs a regular file\n");
+        close(fd);
+        return 0;
+    }
+    if (!S_ISREG(st.st_mode) || opts.follow)
+    {
+        if (opts.pin)
+            pin_threads();
+        struct counters *ctr = opts.counters ? open_thread_counters() : NULL;
+        struct counter_totals phases[NPHASES];
+        memset(phases, 0, sizeof phases);
+        const char *follow = S_ISREG(st.st_mode) && opts.follow ? path : NULL;
+        int rc = process_stream(fd, &opts, opts.xml ? &filter : NULL, follow);
+        if (fd != STDIN_FILENO)
+            close(fd);
+        end_phase(ctr, &phases[PHASE_SCAN]);
+        if (ctr)
+            report_counters(ctr, phases);
+        if (opts.affinity)
+            report_affinity();
+        return rc == 0 ? 1 : 0;
+    }
+
+    // a mapped file isn't read in batches, so a batch size would have no effect
+    if (opts.slab_size)
+    {
+        fprintf(stderr, "--slab-size only applies to pipes, stdin and --follow in the OpenMP version\n");
+        close(fd);
+        return 0;
+    }
+
+    // --limit-bytes only maps the start of the file, which is exactly what head -c would have copied
     size_t filesize = st.st_size;
+    if (opts.limit_bytes && filesize > opts.limit_bytes)
+        filesize = (size_t)opts.limit_bytes;
     if (filesize == 0)
     {
         fprintf(stderr, "Empty file\n");
@@ -40,88 +970,154 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    // maps the file to memory, as suggested by https://hpc-tutorials.llnl.gov/openmp/
-    // reports an error if one occurred; protection is set to read only, MAP_PRIVATE
-    // flag indicates writes made to the mapped memory aren't visible to the underlying
-    // file and won't be seen by other processes mapping the same file
-    char *buf = mmap(NULL, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (buf == MAP_FAILED)
+    // --approx reads only the sampled blocks and prints its estimates in place of any other output
+    if (opts.approx)
+    {
+        if (opts.pin)
+            pin_threads();
+        int rc = process_approx(fd, filesize, &opts);
+        close(fd);
+        return rc == 0 ? 1 : 0;
+    }
+
+    // --auto-tune picks the thread count, chunk size and I/O mode before the input is loaded
+    if (opts.auto_tune)
+        auto_tune(fd, filesize, &opts);
+
+    // --pin: each thread stays on its own CPU from here on
+    if (opts.pin)
+        pin_threads();
+
+    // --counters: counting starts here, so calibration isn't included
+    struct counters *ctr = opts.counters ? open_thread_counters() : NULL;
+    struct counter_totals phases[NPHASES];
+    memset(phases, 0, sizeof phases);
+
+    // maps the file to memory or reads it (--io=read), see load_input; reports an error if one occurred
+    char *buf = load_input(fd, filesize, opts.io_read);
+    if (!buf)
     {
-        perror("mmap");
         close(fd);
         return 0;
     }
     close(fd);
+    end_phase(ctr, &phases[PHASE_LOAD]);
 
-    // scans the entire buffer one time to count newline characters, if the file doesn't end in
-    // \n, it adds one more line for the final, non-terminated line
-    size_t nlines = 0;
-    for (size_t i = 0; i < filesize; ++i)
+    // indexes the buffer: only the position of each newline is kept, as a 32-bit offset (see
+    // common/lineindex.h), and each line's maximum fits in one byte; reports a failure if one occurred
+    struct line_index idx;
+    if (build_index(&idx, buf, filesize) != 0)
     {
-        if (buf[i] == '\n') nlines++;
+        fprintf(stderr, "Allocation failure\n");
+        release_input(buf, filesize, opts.io_read);
+        return 0;
     }
-    if (filesize > 0 && buf[filesize-1] != '\n')
-        nlines++;
-
-    // allocates helper arrays to hold byte offsets and the maximum value of each line
-    // reports a failure if one occurred
-    size_t * start = malloc(nlines * sizeof(size_t));
-    size_t * end = malloc(nlines * sizeof(size_t));
-    int * maxval = malloc(nlines * sizeof(int));
-    if (!start || !end || !maxval)
+    size_t nlines = idx.nlines;
+    unsigned char *maxval = malloc(nlines ? nlines : 1);
+    if (!maxval)
     {
         fprintf(stderr, "Allocation failure\n");
-        munmap(buf, filesize);
+        lineidx_free(&idx);
+        release_input(buf, filesize, opts.io_read);
         return 0;
     }
 
-    // iterates over the buffer again, and whenever it sees \n, sets start[i] to the byte after
-    // the previous newline (or 0 for the first line), sets end[i] to the position of the current
-    // newline, and updates last to the next character
-    size_t idx = 0, last = 0;
-    for (size_t i = 0; i < filesize; ++i)
+    // --xml: the structural pass finds the content of the chosen elements before the scan, and counts as
+    // part of indexing
+    struct xml_regions regions;
+    double t_struct = omp_get_wtime();
+    if (opts.xml)
     {
-        if (buf[i] == '\n')
+        if (find_content(&filter, buf, filesize, 0, &regions) != 0)
         {
-            start[idx] = last;
-            end[idx] = i;
-            last = i + 1;
-            idx++;
+            fprintf(stderr, "Allocation failure\n");
+            free(maxval);
+            lineidx_free(&idx);
+            release_input(buf, filesize, opts.io_read);
+            return 0;
         }
+        xml_content = &regions;
     }
-    // if there's a trailing non-newline line, its start and end are addded
-    if (last < filesize)
+    t_struct = omp_get_wtime() - t_struct;
+    end_phase(ctr, &phases[PHASE_INDEX]);
+
+    // reports how much per-line metadata is kept, next to what the start/end/maxval arrays used to take
+    if (opts.index_stats)
     {
-        start[idx] = last;
-        end[idx] = filesize;
+        size_t bytes = lineidx_bytes(&idx) + nlines;
+        fprintf(stderr, "index: %zu lines, %zu bytes (%.2f bytes/line), previous layout %zu bytes\n",
+                nlines, bytes, nlines ? (double)bytes / nlines : 0.0,
+                nlines * (2 * sizeof(size_t) + sizeof(int)));
     }
 
-    // openMP parallel for loop splits the lines evenly among the threads and retrieves the
-    // maximum printable ASCII value per line
-    #pragma omp parallel for schedule(static)
-    for (size_t i = 0; i < nlines; ++i)
+    double t_scan = omp_get_wtime(), scan_done = 0;
+    if (opts.summary || opts.top_k || opts.digest)
     {
-        int maxValue = 0;
-        for (size_t j = start[i]; j < end[i]; ++j)
+        // only the histogram, the highest lines and/or the digest are printed, see aggregate
+        struct histogram hist;
+        struct topk top;
+        struct digest dg;
+        hist_init(&hist);
+        digest_init(&dg);
+        if (topk_init(&top, opts.top_k) != 0)
+            fprintf(stderr, "Allocation failure\n");
+        else
         {
-            unsigned char c = buf[j];
-            if (c >= 32 && c <= 126 && c > maxValue)
-                maxValue = c;
+            if (aggregate(&idx, maxval, 0, &opts, &hist, &top, &dg) == 0)
+                print_aggregate(&opts, &hist, &top, &dg);
+            topk_free(&top);
         }
-        maxval[i] = maxValue;
     }
+    else if (opts.parallel_output)
+    {
+        // computes and formats the results in parallel, see parallel_output
+        parallel_output(&idx, maxval, 0, opts.min_value, opts.output_path, STDOUT_FILENO);
+    }
+    else
+    {
+        // openMP parallel region retrieves the maximum printable ASCII value per line, splitting the
+        // lines evenly among the threads or in chunks of --chunk-lines lines, see compute_all
+        compute_all(&idx, maxval, omp_get_max_threads(), opts.chunk_lines);
+        scan_done = omp_get_wtime();
+        end_phase(ctr, &phases[PHASE_SCAN]);
 
-    // prints the results
-    for (size_t i = 0; i < nlines; ++i)
+        // prints the results (those at or above --min-value, which defaults to 0)
+        for (size_t i = 0; i < nlines; ++i)
+        {
+            if (maxval[i] >= opts.min_value)
+                printf("%zu: %d\n", i, maxval[i]);
+        }
+    }
+
+    end_phase(ctr, &phases[PHASE_OUTPUT]);
+
+    // --xml --stats: the throughput of the structural pass and of the scan over the input; in the aggregate
+    // and --parallel-output modes the scan can't be told apart from the output, so both are timed together
+    if (opts.xml && opts.stats)
     {
-        printf("%zu: %d\n", i, maxval[i]);
+        size_t content = 0;
+        for (size_t k = 0; k < regions.n; ++k)
+            content += regions.r[k].end - regions.r[k].start;
+        t_scan = (scan_done ? scan_done : omp_get_wtime()) - t_scan;
+        fflush(stdout);
+        fprintf(stderr, "xml: %zu elements, %zu of %zu bytes are content; structural pass %.3f s (%.0f MB/s), "
+                "scan%s %.3f s (%.0f MB/s)\n", regions.n, content, filesize, t_struct,
+                filesize / 1e6 / (t_struct > 0 ? t_struct : 1e-9), scan_done ? "" : "+output", t_scan,
+                filesize / 1e6 / (t_scan > 0 ? t_scan : 1e-9));
     }
 
+    // reports the counters of every phase, summed over the threads, and where the threads ran
+    if (ctr)
+        report_counters(ctr, phases);
+    if (opts.affinity)
+        report_affinity();
+
     // cleanup; frees memory
-    free(start);
-    free(end);
+    lineidx_free(&idx);
     free(maxval);
-    munmap(buf, filesize);
+    if (opts.xml)
+        xml_regions_free(&regions);
+    release_input(buf, filesize, opts.io_read);
 
     // success
     return 1;
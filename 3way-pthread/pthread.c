@@ -1,53 +1,265 @@
+// sched_getcpu and the CPU_SET macros used by common/affinity.h are GNU extensions
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
-#define MAX_LINE_LENGTH 4096
+#include "../common/affinity.h"
+#include "../common/aggregate.h"
+#include "../common/counters.h"
+#include "../common/digest.h"
+#include "../common/kernel.h"
+#include "../common/lineindex.h"
+#include "../common/options.h"
+#include "../common/outbuf.h"
+#include "../common/stream.h"
+
+#define READ_CHUNK (1 << 20)
 
 int numThreads;
-char **lines = NULL;      // Array of pointers to all lines
+char *data = NULL;        // The whole file, read into one buffer
+size_t data_size = 0;     // Number of bytes read
+struct line_index line_idx;  // Compact index of where each line ends in data
 int total_lines = 0;      // Number of lines read
-int capacity = 10000;     // initial capacity
-int *results = NULL;      // Global results: max ASCII value for each line
+unsigned char *results = NULL;  // Global results: max ASCII value for each line
+size_t results_cap = 0;   // Number of values results has room for
+size_t line_base = 0;     // Global number of the first line in data; non-zero for later batches of a stream
+int streaming = 0;        // set when the input is a pipe or stdin, read batch by batch
+int stream_out_fd = STDOUT_FILENO;  // where a stream's --parallel-output batches are written
+struct counters main_ctr;  // with --counters, the main thread's own counters (reading and printing)
+int *worker_cpus = NULL;   // with --affinity, the CPU each thread was on when it finished scanning
+struct run_options opts;  // command line options
+struct byte_class line_class;  // with --class, the bytes that count towards a line's maximum
+struct out_buffer *out_bufs = NULL;  // per-thread formatted output, only used with --parallel-output
+pthread_barrier_t out_barrier;       // lines the threads up before copying into the output file
+char *out_map = NULL;                // the mapped output file for --output, set by one thread
+size_t out_total = 0;                // size of the mapped output file
+int out_failed = 0;                  // set when a buffer or the output file couldn't be allocated
+pthread_mutex_t mutexsum;            // mutex for hist and top
+struct histogram hist;               // histogram of the values, only used with --summary
+struct topk top;                     // the highest lines, only used with --top-k
+int aggregate_failed = 0;            // set when a thread couldn't allocate its local heap
+struct digest dg;                    // hash of the (line, value) pairs, only used with --digest
+struct digest *thread_digests = NULL;  // each thread's digest of its range, merged into dg in thread order
+
+///
+/// A line longer than SPLIT_LINE_BYTES (common/kernel.h), cut into pieces of SPLIT_PIECE_BYTES that the
+/// threads done with their own lines scan alongside the thread the line belongs to
+///
+struct split_line
+{
+    size_t start, end;        // the line's bytes in data
+    size_t npieces;           // number of pieces
+    size_t handed_out;        // pieces taken by a thread so far
+    size_t done;              // pieces scanned so far
+    int max_value;            // maximum over the scanned pieces
+    struct split_line *next;  // next line that still has pieces to hand out
+};
+
+pthread_mutex_t split_mutex = PTHREAD_MUTEX_INITIALIZER;  // guards the split lines and scanning_threads
+pthread_cond_t split_cond = PTHREAD_COND_INITIALIZER;     // signalled when a piece is added or finished
+struct split_line *split_lines = NULL;  // lines with pieces left to hand out
+int scanning_threads = 0;               // threads still working through their own range of lines
+
+// --counters splits the run into these phases; the workers' counts all go to scan, which includes
+// formatting the output in --parallel-output mode
+enum { PHASE_READ, PHASE_SCAN, PHASE_OUTPUT, NPHASES };
+const char *const phase_names[NPHASES] = { "read", "scan", "output" };
+struct counter_totals phases[NPHASES];  // counters summed over the threads, per phase
+
+///
+/// Adds what the calling worker counted to the scan phase and closes its counters, before it exits
+/// \param ctr the counters the worker opened when it started
+///
+void finish_thread_counters(struct counters *ctr)
+{
+    if(!opts.counters)
+        return;
+    counters_take(ctr, &phases[PHASE_SCAN]);
+    counters_close(ctr);
+}
 
 ///
-/// Reads in all lines in the file to the lines pointer
+/// Maps the output file once every thread has formatted its range; called by exactly one thread
+///
+void map_output_file(void)
+{
+    out_total = 0;
+    for(int i = 0; i < numThreads; i++)
+    {
+        if(!out_bufs[i].data)
+            out_failed = 1;
+        out_total += out_bufs[i].len;
+    }
+    if(out_failed || out_file_map(opts.output_path, out_total, &out_map) != 0)
+        out_failed = 1;
+}
+
+///
+/// Reads the whole file into the data buffer and indexes its lines
 /// \param filename a string representing the name of the file being read from
 ///
 void read_file(const char *filename)
 {
     // opening the file and checking for param issue
-    FILE *fp = fopen(filename, "r");
+    FILE *fp = fopen(filename, "rb");
     if(!fp)
     {
         perror("Unable to open file");
         return;
     }
 
-    // allocate memory for the lines
-    lines = malloc(capacity * sizeof(char *));
-    if(!lines)
+    // reads the file in large chunks, doubling the buffer whenever it fills up
+    size_t capacity = READ_CHUNK;
+    data = malloc(capacity);
+    if(!data)
     {
         perror("malloc failure");
+        fclose(fp);
         return;
     }
-
-    // places the lines from the file into the lines array
-    char buffer[MAX_LINE_LENGTH];
-    while(fgets(buffer, MAX_LINE_LENGTH, fp))
+    // with --limit-bytes only the start of the file is read, just like head -c would have copied it
+    size_t got, want;
+    while((want = capacity - data_size) > 0)
     {
-        if(total_lines == capacity)
+        if(opts.limit_bytes && want > opts.limit_bytes - data_size)
+            want = (size_t)(opts.limit_bytes - data_size);
+        if(!want || (got = fread(data + data_size, 1, want, fp)) == 0)
+            break;
+        data_size += got;
+        if(data_size == capacity)
         {
             capacity *= 2;
-            lines = realloc(lines, capacity * sizeof(char *));
+            char *grown = realloc(data, capacity);
+            if(!grown)
+            {
+                perror("realloc failure");
+                break;
+            }
+            data = grown;
         }
-        lines[total_lines] = strdup(buffer);
-        total_lines++;
     }
-
     fclose(fp);
+
+    // only the position of each newline is kept, as a 32-bit offset (see common/lineindex.h)
+    if(lineidx_build(&line_idx, data, data_size) != 0)
+    {
+        perror("malloc failure for line index");
+        return;
+    }
+    total_lines = (int)line_idx.nlines;
+}
+
+///
+/// Maximum of the bytes in data[lo, hi), compared as signed chars, starting from max_value; with --class
+/// only the bytes of the class count, with their value in it (see line_max_in_class)
+///
+int range_max(size_t lo, size_t hi, int max_value)
+{
+    if(opts.byte_class)
+    {
+        int v = (int)line_max_in_class(&line_class, data + lo, data + hi);
+        return v > max_value ? v : max_value;
+    }
+    for(size_t j = lo; j < hi; j++)
+    {
+        if((int)data[j] > max_value)
+        {
+            max_value = data[j];
+        }
+    }
+    return max_value;
+}
+
+///
+/// Hands out the next unscanned piece of a split line; call with split_mutex held. A line whose last
+/// piece is handed out leaves the list, its owner keeps track of it until every piece is done
+/// \param own only take pieces of this line, or of any line if NULL
+/// \return the line the piece belongs to, or NULL if there's nothing to hand out
+///
+struct split_line *take_piece(struct split_line *own, size_t *lo, size_t *hi)
+{
+    struct split_line **link = &split_lines;
+    while(*link && own && *link != own)
+        link = &(*link)->next;
+    struct split_line *sl = *link;
+    if(!sl)
+        return NULL;
+
+    *lo = sl->start + sl->handed_out * SPLIT_PIECE_BYTES;
+    *hi = (sl->end - *lo > SPLIT_PIECE_BYTES) ? *lo + SPLIT_PIECE_BYTES : sl->end;
+    if(++sl->handed_out == sl->npieces)
+        *link = sl->next;
+    return sl;
+}
+
+///
+/// Scans a piece handed out by take_piece and folds its maximum into the line's; call with split_mutex
+/// held, it's released while the piece is scanned
+///
+void scan_piece(struct split_line *sl, size_t lo, size_t hi)
+{
+    pthread_mutex_unlock(&split_mutex);
+    int max_value = range_max(lo, hi, 0);
+    pthread_mutex_lock(&split_mutex);
+    if(max_value > sl->max_value)
+        sl->max_value = max_value;
+    sl->done++;
+    pthread_cond_broadcast(&split_cond);
+}
+
+///
+/// Maximum of a line longer than SPLIT_LINE_BYTES: the line's pieces are offered to the other threads
+/// and the calling thread scans them too, then waits for the pieces the others took; the pieces'
+/// maxima are combined with a max reduction
+/// \param max_value the value the line starts from ('\n' when it has a newline, unless --class is given)
+///
+int split_line_max(size_t start, size_t end, int max_value)
+{
+    struct split_line sl = { start, end, (end - start + SPLIT_PIECE_BYTES - 1) / SPLIT_PIECE_BYTES, 0, 0,
+                             max_value, NULL };
+    size_t lo, hi;
+
+    pthread_mutex_lock(&split_mutex);
+    sl.next = split_lines;
+    split_lines = &sl;
+    pthread_cond_broadcast(&split_cond);
+
+    while(take_piece(&sl, &lo, &hi))
+        scan_piece(&sl, lo, hi);
+    while(sl.done < sl.npieces)
+        pthread_cond_wait(&split_cond, &split_mutex);
+    pthread_mutex_unlock(&split_mutex);
+    return sl.max_value;
+}
+
+///
+/// Called by a thread done with its own lines: scans pieces of other threads' long lines until every
+/// thread is through its range, so nobody sits idle while one thread works through a huge line
+///
+void help_split_lines(void)
+{
+    struct split_line *sl;
+    size_t lo, hi;
+
+    pthread_mutex_lock(&split_mutex);
+    scanning_threads--;
+    pthread_cond_broadcast(&split_cond);
+    for(;;)
+    {
+        if((sl = take_piece(NULL, &lo, &hi)) != NULL)
+            scan_piece(sl, lo, hi);
+        else if(scanning_threads == 0)
+            break;
+        else
+            pthread_cond_wait(&split_cond, &split_mutex);
+    }
+    pthread_mutex_unlock(&split_mutex);
 }
 
 ///
@@ -61,53 +273,132 @@ void *process_lines(void *arg)
     int start = threadID * (total_lines / numThreads);
     int end = (threadID == numThreads - 1) ? total_lines : start + (total_lines / numThreads);
 
-    // algorithm to find the max value in each line and store it in the results array once it's found
+    // with --pin the thread stays on its own CPU
+    if(opts.pin)
+        affinity_pin(threadID);
+
+    // with --counters every worker counts its own events, see finish_thread_counters
+    struct counters ctr;
+    if(opts.counters)
+        counters_open(&ctr);
+
+    // algorithm to find the max value in each line and store it in the results array once it's found;
+    // the lines used to be read with fgets, which kept the newline, so it still counts towards the max
+    // (unless --class picks the bytes that count). Lines longer than SPLIT_LINE_BYTES are shared with the
+    // other threads, see split_line_max
+    struct line_cursor cursor;
+    size_t line_start, line_end;
+    lineidx_cursor_init(&cursor, &line_idx, start);
     for(int i = start; i < end; i++)
     {
-        int max_value = 0;
-        char *line = lines[i];
-        for(int j = 0; line[j] != '\0'; j++)
+        lineidx_next(&cursor, &line_start, &line_end);
+        int max_value = (line_end < data_size && !opts.byte_class) ? '\n' : 0;
+        if(line_end - line_start > SPLIT_LINE_BYTES)
+            max_value = split_line_max(line_start, line_end, max_value);
+        else
+            max_value = range_max(line_start, line_end, max_value);
+        results[i] = (unsigned char)max_value;
+    }
+    help_split_lines();
+    if(opts.affinity)
+        worker_cpus[threadID] = sched_getcpu();
+
+    // in the aggregate modes the thread counts its lines into a local histogram and heap, then sums
+    // them up into the global ones; its digest is left for main to merge, since the order matters
+    if(opts.summary || opts.top_k || opts.digest)
+    {
+        struct histogram local_hist;
+        struct topk local_top;
+        hist_init(&local_hist);
+        if(topk_init(&local_top, opts.top_k) != 0)
         {
-            if((int)line[j] > max_value)
+            pthread_mutex_lock(&mutexsum);
+            aggregate_failed = 1;
+            pthread_mutex_unlock(&mutexsum);
+            finish_thread_counters(&ctr);
+            pthread_exit(NULL);
+        }
+
+        for(int i = start; i < end; i++)
+        {
+            if(results[i] < opts.min_value)
+                continue;
+            hist_add(&local_hist, results[i]);
+            topk_push(&local_top, results[i], (unsigned long long)(line_base + i));
+            if(opts.digest)
+                digest_add(&thread_digests[threadID], line_base + i, results[i]);
+        }
+
+        pthread_mutex_lock(&mutexsum);
+        hist_merge(&hist, &local_hist);
+        topk_merge(&top, &local_top);
+        pthread_mutex_unlock(&mutexsum);
+        topk_free(&local_top);
+    }
+
+    // in parallel output mode the thread formats its own range as soon as it's computed; a NULL
+    // buffer tells the others the allocation failed
+    else if(opts.parallel_output)
+    {
+        if(out_buffer_init(&out_bufs[threadID], end - start) == 0)
+        {
+            for(int i = start; i < end; i++)
             {
-                max_value = line[j];
+                if(results[i] >= opts.min_value)
+                    out_append(&out_bufs[threadID], line_base + i, results[i]);
+            }
+        }
+
+        // with an output file, one thread sizes and maps it after every buffer is complete, then each
+        // thread copies its own buffer to the offset just past all lower-numbered threads' bytes; a
+        // stream's batches are appended to the file by the main thread instead
+        if(opts.output_path && !streaming)
+        {
+            if(pthread_barrier_wait(&out_barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+                map_output_file();
+            pthread_barrier_wait(&out_barrier);
+
+            if(!out_failed && out_map)
+            {
+                size_t offset = 0;
+                for(int i = 0; i < threadID; i++)
+                    offset += out_bufs[i].len;
+                memcpy(out_map + offset, out_bufs[threadID].data, out_bufs[threadID].len);
             }
         }
-        results[i] = max_value;
     }
+    finish_thread_counters(&ctr);
     pthread_exit(NULL);
 }
 
 ///
-/// Main function, sets up pthreads and prints out results
-/// \param argc number of arguments passed when pthread.c was executed
-/// \param argv the arguments passed in text form, in this case it will be a file name
+/// Runs the worker threads over the lines in data and line_idx, then prints their results; in the
+/// aggregate modes the threads only add them to hist and top, which main prints at the end
+/// \return 0 on success, -1 on failure (an error has been printed)
 ///
-int main(int argc, char *argv[])
+int process_batch(void)
 {
-    // param check, informs user correct format to run the executable with
-    if(argc < 3)
+    // the results array is reused from batch to batch and only grows
+    if((size_t)total_lines > results_cap || !results)
     {
-        fprintf(stderr, "Usage: %s <input_file> <num_threads>\n", argv[0]);
-        return 0;
-    }
-
-    // parse thread count from argv[2]
-    if (sscanf(argv[2], "%d", &numThreads) != 1 || numThreads < 1)
-    {
-        fprintf(stderr, "Invalid thread count: %s\n", argv[2]);
-        return 0;
+        free(results);
+        results_cap = total_lines ? (size_t)total_lines : 1;
+        results = malloc(results_cap);
+        if(!results)
+        {
+            perror("malloc failure for results");
+            return -1;
+        }
     }
 
-    // Read the file into memory
-    read_file(argv[1]);
-
-    // Allocate the results array
-    results = malloc(total_lines * sizeof(int));
-    if(!results)
+    if(opts.parallel_output)
     {
-        perror("malloc failure for results");
-        return 0;
+        out_bufs = calloc(numThreads, sizeof *out_bufs);
+        if(!out_bufs)
+        {
+            perror("malloc failure for output buffers");
+            return -1;
+        }
     }
 
     pthread_t *threads = malloc(numThreads * sizeof(pthread_t));
@@ -119,13 +410,14 @@ int main(int argc, char *argv[])
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
 
     // creating new threads
+    scanning_threads = numThreads;
     for(int i = 0; i < numThreads; i++)
     {
         rc = pthread_create(&threads[i], &attr, process_lines, (void *)(intptr_t)i);
         if(rc)
         {
             fprintf(stderr, "Error: return code from pthread_create() is %d\n", rc);
-            return 0;
+            return -1;
         }
     }
 
@@ -139,22 +431,295 @@ int main(int argc, char *argv[])
         if(rc)
         {
             fprintf(stderr, "Error: return code from pthread_join() is %d\n", rc);
+            return -1;
+        }
+    }
+    free(threads);
+
+    // the time main waits for the threads counts towards the scan
+    if(opts.counters)
+        counters_take(&main_ctr, &phases[PHASE_SCAN]);
+
+    if(opts.summary || opts.top_k || opts.digest)
+    {
+        // printed by main once every batch has been counted; the threads' digests are appended in
+        // the order of their ranges
+        if(opts.digest)
+        {
+            for(int i = 0; i < numThreads; i++)
+            {
+                digest_merge(&dg, &thread_digests[i]);
+                digest_init(&thread_digests[i]);
+            }
+        }
+    }
+    else if(opts.parallel_output)
+    {
+        // the threads already formatted their ranges (and copied them into the output file, if one
+        // was given); for stdout (or a stream's output file) the buffers are written out in thread
+        // order with writev
+        for(int i = 0; i < numThreads; i++)
+        {
+            if(!out_bufs[i].data)
+                out_failed = 1;
+        }
+
+        if(out_failed)
+            fprintf(stderr, "malloc failure for output buffers\n");
+        else if(opts.output_path && out_map)
+            munmap(out_map, out_total);
+        else if(!opts.output_path || streaming)
+            write_buffers_ordered(stream_out_fd, out_bufs, numThreads);
+
+        for(int i = 0; i < numThreads; i++)
+            free(out_bufs[i].data);
+        free(out_bufs);
+        out_bufs = NULL;
+        out_map = NULL;
+        if(out_failed)
+            return -1;
+    }
+    else
+    {
+        // Print the results for each line in order (those at or above --min-value, which defaults to 0)
+        for(int i = 0; i < total_lines; i++)
+        {
+            if(results[i] >= opts.min_value)
+                printf("%zu: %d\n", line_base + i, results[i]);
+        }
+        if(streaming)
+            fflush(stdout);
+    }
+    if(opts.counters)
+        counters_take(&main_ctr, &phases[PHASE_OUTPUT]);
+    return 0;
+}
+
+///
+/// Reads a pipe or stdin in batches of whole lines (see common/stream.h) and processes each batch
+/// like a whole file as soon as it's read, so the results come out before the input ends
+/// \param fd the descriptor to read from
+/// \return 0 on success, -1 on failure
+///
+int process_stream(int fd)
+{
+    struct line_stream ls;
+    const char *batch;
+    long long len;
+    int rc = 0;
+
+    if(stream_init(&ls, fd, opts.slab_size, opts.limit_bytes) != 0)
+    {
+        perror("malloc failure for stream buffer");
+        return -1;
+    }
+
+    // the size of a stream's output isn't known up front, so --output gets every batch appended
+    if(opts.parallel_output && opts.output_path)
+    {
+        stream_out_fd = open(opts.output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(stream_out_fd < 0)
+        {
+            perror("open output");
+            stream_free(&ls);
+            return -1;
+        }
+    }
+
+    while(rc == 0 && (len = stream_next(&ls, &batch)) > 0)
+    {
+        if(opts.counters)
+            counters_take(&main_ctr, &phases[PHASE_READ]);
+        // the threads only read the batch
+        data = (char *)batch;
+        data_size = (size_t)len;
+        if(lineidx_build(&line_idx, data, data_size) != 0)
+        {
+            perror("malloc failure for line index");
+            rc = -1;
+            break;
+        }
+        total_lines = (int)line_idx.nlines;
+        rc = process_batch();
+        line_base += (size_t)total_lines;
+        lineidx_free(&line_idx);
+    }
+    if(len < 0)
+        rc = -1;
+
+    if(stream_out_fd != STDOUT_FILENO)
+        close(stream_out_fd);
+    data = NULL;
+    stream_free(&ls);
+    return rc;
+}
+
+///
+/// Main function, sets up pthreads and prints out results
+/// \param argc number of arguments passed when pthread.c was executed
+/// \param argv the arguments passed in text form, in this case it will be a file name, or "-" for stdin
+///
+int main(int argc, char *argv[])
+{
+    // param check, informs user correct format to run the executable with
+    const char *args[2];
+    if(parse_options(argc, argv, BACKEND_PTHREAD, &opts, args, 2) != 2)
+    {
+        fprintf(stderr, "Usage: %s [options] <input_file> <num_threads>\n", argv[0]);
+        print_options_usage();
+        return 0;
+    }
+
+    // parse thread count from the second positional argument
+    if (sscanf(args[1], "%d", &numThreads) != 1 || numThreads < 1)
+    {
+        fprintf(stderr, "Invalid thread count: %s\n", args[1]);
+        return 0;
+    }
+
+    // --class: without it every byte counts, compared as a signed char
+    if(opts.byte_class && byte_class_init(&line_class, opts.byte_class) != 0)
+    {
+        fprintf(stderr, "Invalid byte class: %s\n", opts.byte_class);
+        return 0;
+    }
+
+    // with --counters the main thread counts the reading and the printing, see finish_thread_counters
+    // for the workers
+    if(opts.counters)
+        counters_open(&main_ctr);
+
+    // with --affinity every thread notes the CPU it's on, reported with their clock at the end
+    if(opts.affinity)
+    {
+        worker_cpus = malloc(numThreads * sizeof *worker_cpus);
+        if(!worker_cpus)
+        {
+            perror("malloc failure for affinity");
             return 0;
         }
     }
 
-    // Print the results for each line in order
-    for(int i = 0; i < total_lines; i++)
+    // the aggregate modes replace the per-line output and are printed once at the end
+    if(opts.summary || opts.top_k || opts.digest)
+    {
+        opts.parallel_output = 0;
+        pthread_mutex_init(&mutexsum, NULL);
+        hist_init(&hist);
+        digest_init(&dg);
+        thread_digests = malloc(numThreads * sizeof *thread_digests);
+        if(topk_init(&top, opts.top_k) != 0 || !thread_digests)
+        {
+            perror("malloc failure for top-k heap");
+            return 0;
+        }
+        for(int i = 0; i < numThreads; i++)
+            digest_init(&thread_digests[i]);
+    }
+    else if(opts.parallel_output)
     {
-        printf("%d: %d\n", i, results[i]);
+        pthread_barrier_init(&out_barrier, NULL, numThreads);
     }
 
-    // free the allocated memory
-    for(int i = 0; i < total_lines; i++)
+    // "-", pipes and other inputs that aren't regular files are read and processed batch by batch
+    // (see process_stream)
+    struct stat st;
+    if(!strcmp(args[0], "-") || (stat(args[0], &st) == 0 && !S_ISREG(st.st_mode)))
     {
-        free(lines[i]);
+        int fd = strcmp(args[0], "-") ? open(args[0], O_RDONLY) : STDIN_FILENO;
+        if(fd < 0)
+        {
+            perror("Unable to open file");
+            return 0;
+        }
+        streaming = 1;
+        int rc = process_stream(fd);
+        if(fd != STDIN_FILENO)
+            close(fd);
+        if(rc != 0)
+            return 0;
     }
-    free(lines);
+    else
+    {
+        // a regular file is read whole, so a batch size would have no effect
+        if(opts.slab_size)
+        {
+            fprintf(stderr, "--slab-size only applies to pipes and stdin in the pthread version\n");
+            return 0;
+        }
+
+        // Read the file into memory
+        read_file(args[0]);
+        if(!line_idx.end)
+            return 0;
+        if(opts.counters)
+            counters_take(&main_ctr, &phases[PHASE_READ]);
+
+        // reports how much per-line metadata is kept, next to what the old pointer-per-line layout took
+        if(opts.index_stats)
+        {
+            size_t bytes = lineidx_bytes(&line_idx) + (size_t)total_lines;
+            fprintf(stderr, "index: %d lines, %zu bytes (%.2f bytes/line), previous layout %zu bytes "
+                    "plus one heap allocation per line\n", total_lines, bytes,
+                    total_lines ? (double)bytes / total_lines : 0.0,
+                    (size_t)total_lines * (sizeof(char *) + sizeof(int)));
+        }
+
+        int rc = process_batch();
+        lineidx_free(&line_idx);
+        free(data);
+        if(rc != 0)
+            return 0;
+    }
+
+    if(opts.summary || opts.top_k || opts.digest)
+    {
+        // print the merged histogram, highest lines and/or digest
+        if(aggregate_failed)
+            fprintf(stderr, "malloc failure for top-k heap\n");
+        else
+        {
+            if(opts.summary)
+                hist_print(&hist);
+            if(opts.top_k)
+                topk_print(&top);
+            if(opts.digest)
+                digest_print(&dg);
+        }
+        topk_free(&top);
+        free(thread_digests);
+        pthread_mutex_destroy(&mutexsum);
+    }
+    else if(opts.parallel_output)
+    {
+        pthread_barrier_destroy(&out_barrier);
+    }
+
+    // reports the counters of every phase, summed over the threads
+    if(opts.counters)
+    {
+        counters_take(&main_ctr, &phases[PHASE_OUTPUT]);
+        counters_close(&main_ctr);
+        fflush(stdout);
+        counters_report(phase_names, phases, NPHASES);
+    }
+
+    // reports where the threads of the last batch ran
+    if(opts.affinity)
+    {
+        double *mhz = malloc(numThreads * sizeof *mhz);
+        if(mhz)
+        {
+            for(int i = 0; i < numThreads; i++)
+                mhz[i] = affinity_cpu_mhz(worker_cpus[i]);
+            fflush(stdout);
+            affinity_report(worker_cpus, mhz, numThreads);
+        }
+        free(mhz);
+        free(worker_cpus);
+    }
+
+    // free the allocated memory
     free(results);
 
     // program completed successfully
@@ -12,29 +12,35 @@ sizes=(60M 120M 240M 720M 1440M 1700M)
 # list of threads
 cores=(1 2 4 8 16 20)
 
+# page cache states: warm trials measure the scan (compute-bound), cold trials reading the input from
+# disk (I/O-bound), see the cache mode parameter of the script
+modes=(warm cold)
+
 last_jid=""
 
-for sz in "${sizes[@]}"; do
-  for th in "${cores[@]}"; do
-    # generate a distinctive job name
-    jobname="pthread_${sz}_${th}"
+for mode in "${modes[@]}"; do
+  for sz in "${sizes[@]}"; do
+    for th in "${cores[@]}"; do
+      # generate a distinctive job name
+      jobname="pthread_${mode}_${sz}_${th}"
 
-    sbatch_cmd=( sbatch
-      --job-name="$jobname"
-      --cpus-per-task="$th"
-      --output="logs/slurm_${sz}_${th}.out"
-    )
+      sbatch_cmd=( sbatch
+        --job-name="$jobname"
+        --cpus-per-task="$th"
+        --output="logs/slurm_${mode}_${sz}_${th}.out"
+      )
 
-    # if this isn’t the first job, add the dependency
-    if [[ -n $last_jid ]]; then
-      sbatch_cmd+=( --dependency=afterok:"$last_jid" )
-    fi
+      # if this isn’t the first job, add the dependency
+      if [[ -n $last_jid ]]; then
+        sbatch_cmd+=( --dependency=afterok:"$last_jid" )
+      fi
 
-    sbatch_cmd+=( pthread_script.sh "$sz" "$th" )
+      sbatch_cmd+=( pthread_script.sh "$sz" "$th" "$mode" )
 
-    # launch and capture the new job’s ID
-    jid=$("${sbatch_cmd[@]}" | awk '{print $4}')
-    last_jid=$jid
+      # launch and capture the new job’s ID
+      jid=$("${sbatch_cmd[@]}" | awk '{print $4}')
+      last_jid=$jid
 
+    done
   done
 done
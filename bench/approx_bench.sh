@@ -0,0 +1,78 @@
+#!/bin/bash
+# validates the OpenMP version's --approx against the exact --summary on prefixes of the dump
+# (--limit-bytes): for every size the exact histogram is computed once, then every sample fraction runs
+# with a few seeds. Reported per run: wall time and speedup over the exact scan, the relative error of the
+# estimated line count and whether the exact count falls within its confidence interval, the coverage (the
+# share of the values found in the sample whose exact count falls within estimate +- interval, about 95% is
+# what the intervals promise) and the values the sample missed altogether, with the lines they account
+# for: a value held by a handful of lines is usually missed, and nothing can be said about it. The input
+# is dropped from the page cache before every run (dd iflag=nocache), since skipping most of the reads is
+# where sampling saves time
+#
+# usage: ./approx_bench.sh [dump] [sizes] [fractions] [threads] [seeds]
+#   e.g. ./approx_bench.sh ~dan/625/wiki_dump.txt "60M 1700M" "0.01 0.05" 8 "1 2 3 4 5"
+
+# if any command in this script returns a non-zero (i.e. “error”) exit status, immediately stop the script
+set -e
+
+# Go to the directory where this script lives
+cd "$(dirname "$0")"
+
+dump=${1:-~dan/625/wiki_dump.txt}
+sizes=${2:-"60M 120M 240M 720M 1440M 1700M"}
+fractions=${3:-"0.01 0.05 0.1"}
+threads=${4:-4}
+seeds=${5:-"1 2 3 4 5"}
+
+mkdir -p build analysis
+gcc -Wall -O2 -fopenmp ../3way-openmp/openmp.c -o build/openmp -lm
+export OMP_NUM_THREADS="$threads"
+
+# runs the openmp executable cold with the given options, its output in $2, and prints the wall time in
+# seconds; it exits with 1 on success, so its status is ignored
+timed() {
+  local out=$1 t0 t1
+  shift
+  dd if="$dump" iflag=nocache count=0 status=none
+  t0=$(date +%s.%N)
+  build/openmp "$@" --limit-bytes="$size" "$dump" > "$out" || true
+  t1=$(date +%s.%N)
+  awk -v a="$t0" -v b="$t1" 'BEGIN{printf "%.3f", b - a}'
+}
+
+for size in $sizes; do
+  out="analysis/approx_${size}_${threads}.txt"
+  exact=$(timed build/exact.txt --summary)
+  printf "%-9s %6s %10s %8s %10s %6s %10s %12s\n" "fraction" "seed" "wall_s" "speedup" "lines_err%" "in_ci" "coverage%" "unseen" > "$out"
+  printf "%-9s %6s %10.3f %8s\n" "exact" "-" "$exact" "1.00" >> "$out"
+  for fraction in $fractions; do
+    for seed in $seeds; do
+      wall=$(timed build/approx.txt --approx="$fraction,$seed")
+      # exact.txt has "lines: N" and "value: N", approx.txt the same with "+- E" after each estimate (E is
+      # NA when too few blocks were sampled, which counts as a miss); unseen is "values/lines"
+      awk -v f="$fraction" -v s="$seed" -v w="$wall" -v x="$exact" '
+        FNR == NR { sub(":", "", $1); truth[$1] = $2; next }
+        /^approx:/ { next }
+        { sub(":", "", $1); est[$1] = $2; ci[$1] = $4 }
+        END {
+          for(k in truth) {
+            if(k == "lines")
+              continue
+            if(!(k in est)) {
+              unseen++
+              unseen_lines += truth[k]
+              continue
+            }
+            n++
+            if(ci[k] != "NA" && (truth[k] - est[k])^2 <= ci[k]^2)
+              hit++
+          }
+          in_ci = ci["lines"] != "NA" && (truth["lines"] - est["lines"])^2 <= ci["lines"]^2 ? "yes" : "no"
+          printf "%-9s %6s %10.3f %8.2f %10.3f %6s %10.1f %12s\n", f, s, w, x / w,
+                 100 * (est["lines"] - truth["lines"]) / truth["lines"], in_ci, n ? 100 * hit / n : 100,
+                 (unseen + 0) "/" (unseen_lines + 0)
+        }' build/exact.txt build/approx.txt >> "$out"
+    done
+  done
+  cat "$out"
+done
@@ -0,0 +1,65 @@
+#!/bin/bash
+# compares the throughput of the OpenMP and MPI scans for every built-in --class and a custom set against
+# the default printable class, on a prefix of the real dump and on a synthetic file of bytes 32-120 in which
+# no class reaches its top value (so no line is cut short by the saturation check)
+#
+# usage: ./class_bench.sh [size] [threads/ranks] [dump]    e.g. ./class_bench.sh 240M 8
+
+# if any command in this script returns a non-zero (i.e. “error”) exit status, immediately stop the script
+set -e
+
+# Go to the directory where this script lives
+cd "$(dirname "$0")"
+
+size=${1:-240M}
+threads=${2:-4}
+dump=${3:-~dan/625/wiki_dump.txt}
+classes="printable ascii alnum letters set:a-x0-9_"
+trials=5
+
+mkdir -p build analysis
+gcc -Wall -O2 -fopenmp ../3way-openmp/openmp.c -o build/openmp -lm
+mpicc -Wall -O2 ../3way-MPI/MPI.c -o build/mpi -lm
+
+real="build/real_${size}.txt"
+synth="build/synthetic_${size}.txt"
+head -c "$size" "$dump" > "$real"
+LC_ALL=C tr -dc ' -x' < /dev/urandom | fold -w 100 | head -c "$size" > "$synth"
+bytes=$(wc -c < "$real")
+
+# runs a command $trials times and prints the mean wall time in seconds; the openmp executable exits
+# with 1 on success, so the status is ignored
+mean_wall() {
+  local total=0 t0 t1
+  for run in $(seq 1 $trials); do
+    t0=$(date +%s.%N)
+    "$@" > /dev/null || true
+    t1=$(date +%s.%N)
+    total=$(awk -v a="$total" -v b="$t0" -v c="$t1" 'BEGIN{print a + c - b}')
+  done
+  awk -v a="$total" -v n="$trials" 'BEGIN{printf "%.3f", a / n}'
+}
+
+out="analysis/class_${size}_${threads}.txt"
+printf "%-8s %-10s %-14s %10s %10s %9s\n" "impl" "input" "class" "wall_s" "MB/s" "relative" > "$out"
+for input in "$real" "$synth"; do
+  name=$(basename "$input" "_${size}.txt")
+  for impl in openmp mpi; do
+    base=""
+    for class in $classes; do
+      if [ "$impl" = openmp ]; then
+        wall=$(OMP_NUM_THREADS="$threads" mean_wall build/openmp --summary --class="$class" "$input")
+      else
+        wall=$(mean_wall mpirun -np "$threads" build/mpi --summary --class="$class" "$input")
+      fi
+      base=${base:-$wall}
+      awk -v i="$impl" -v f="$name" -v c="$class" -v w="$wall" -v b="$bytes" -v p="$base" \
+        'BEGIN{printf "%-8s %-10s %-14s %10.3f %10.0f %8.2fx\n", i, f, c, w, b / 1e6 / w, p / w}' >> "$out"
+    done
+  done
+done
+
+# remove the input files
+rm -f "$real" "$synth"
+
+cat "$out"
@@ -0,0 +1,91 @@
+#!/bin/bash
+# sweeps MPI-IO hints for the MPI version over the size x ranks grid of the submit scripts: every hint set
+# runs with --io-hints on a prefix of the dump (--limit-bytes), reading the input with the default
+# collective read and writing the results with --parallel-output --output, so the hints affect both the
+# collective read and the collective write; the input is dropped from the page cache before every trial
+# (dd iflag=nocache) so the reads reach the file system. --stats reports the slowest rank's phase times
+# and the hints the library actually took
+#
+# usage: ./io_hints_bench.sh [dump] [sizes] [ranks] [hint sets] [output dir]
+#   e.g. ./io_hints_bench.sh /scratch/$USER/wiki_dump.txt "720M 1700M" "8 20" "none cb_nodes=2,romio_cb_read=enable" \
+#        /scratch/$USER
+# the dump can live on the parallel file system or, to try things out locally, on ext4 or tmpfs; a hint
+# set is a comma-separated --io-hints list, or "none" for the library defaults. The results file is
+# written into the output directory ($TMPDIR, or /tmp, by default), which must be writable; put it on the
+# same file system as the dump so the striping hints apply to it
+
+# if any command in this script returns a non-zero (i.e. “error”) exit status, immediately stop the script
+set -e
+
+# Go to the directory where this script lives
+cd "$(dirname "$0")"
+
+dump=${1:-~dan/625/wiki_dump.txt}
+sizes=${2:-"60M 120M 240M 720M 1440M 1700M"}
+ranks_list=${3:-"1 2 4 8 16 20"}
+hint_sets=${4:-"none romio_cb_read=enable romio_cb_read=disable cb_nodes=1 cb_nodes=2 cb_buffer_size=4M
+  cb_buffer_size=64M romio_cb_read=enable,cb_buffer_size=64M striping_factor=4,striping_unit=1M"}
+outdir=${5:-${TMPDIR:-/tmp}}
+trials=5
+
+if [[ ! -r $dump ]]; then
+  echo "io_hints_bench: can't read the dump $dump" >&2
+  exit 1
+fi
+if [[ ! -d $outdir || ! -w $outdir ]]; then
+  echo "io_hints_bench: the output directory $outdir isn't writable" >&2
+  exit 1
+fi
+
+mkdir -p build analysis
+mpicc -Wall -O2 ../3way-MPI/MPI.c -o build/mpi -lm
+
+output="$outdir/io_hints_bench_out.$$.txt"
+
+# runs one hint set $trials times and prints the mean wall time and the read+scan and output times of the
+# trials that succeeded; a failed trial is reported on stderr, and the hint set fails if none succeeded.
+# measure runs in a command substitution, where set -e doesn't apply, so mpirun's status is checked here
+measure() {
+  local hints=() t0 t1
+  [[ $1 != none ]] && hints=(--io-hints="$1")
+  : > build/trials.txt
+  for run in $(seq 1 $trials); do
+    dd if="$dump" iflag=nocache count=0 status=none
+    rm -f "$output"
+    t0=$(date +%s.%N)
+    if ! mpirun -np "$ranks" build/mpi --stats --limit-bytes="$size" --parallel-output --output="$output" \
+        "${hints[@]}" "$dump" 2> build/stats.txt; then
+      echo "io_hints_bench: trial $run with hints $1 failed:" >&2
+      cat build/stats.txt >&2
+      continue
+    fi
+    t1=$(date +%s.%N)
+    # stats: read+scan S s, collect S s, output S s, ...
+    awk -v w="$(awk -v a="$t0" -v b="$t1" 'BEGIN{print b - a}')" '/^stats:/ {print w, $3, $9}' build/stats.txt \
+      >> build/trials.txt
+    cp build/stats.txt build/stats_ok.txt
+  done
+  if [[ ! -s build/trials.txt ]]; then
+    echo "io_hints_bench: no trial with hints $1 succeeded (size $size, $ranks ranks)" >&2
+    return 1
+  fi
+  awk '{for(i = 1; i <= 3; i++) s[i] += $i} END{for(i = 1; i <= 3; i++) printf " %12.3f", s[i] / NR}' build/trials.txt
+  # the hints in effect, as reported by the last trial that succeeded
+  printf "  %s\n" "$(sed -n 's/^io hints: //p' build/stats_ok.txt)"
+}
+
+for size in $sizes; do
+  for ranks in $ranks_list; do
+    out="analysis/mpiio_${size}_${ranks}.txt"
+    printf "%-48s %12s %12s %12s  %s\n" "hints" "wall_s" "scan_s" "output_s" "in effect" > "$out"
+    for h in $hint_sets; do
+      # the assignment carries measure's status, so set -e stops the script if a hint set failed
+      row=$(measure "$h")
+      printf "%-48s%s\n" "$h" "$row" >> "$out"
+    done
+    cat "$out"
+  done
+done
+
+# remove the results file
+rm -f "$output"
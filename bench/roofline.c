@@ -0,0 +1,310 @@
+// read-bandwidth roofline for the per-line kernels: measures how fast threads can stream through an
+// in-memory buffer (a STREAM-like read kernel that only sums the bytes), then runs every per-line kernel
+// variant over the same buffer with the same threads and reports its throughput as a share of that ceiling
+//
+// usage: ./roofline <file> <size> <threads> [trials]    e.g. ./roofline ~dan/625/wiki_dump.txt 720M 8
+//
+// the first <size> bytes of <file> are read into memory once (untimed), so only the kernels are measured;
+// results go to analysis/<variant>_<size>_<threads>_summary.txt, in the same format as the submit scripts'
+// summaries, with the metrics gbps and pct_peak
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <omp.h>
+
+#include "../common/kernel.h"
+#include "../common/lineindex.h"
+#include "../common/options.h"
+
+#define NVARIANTS 5
+#define DEFAULT_TRIALS 5
+
+// the input, split into one line-aligned byte range per thread: thread t scans [split[t], split[t + 1])
+// and its first line is first_line[t]
+static const char *buf;
+static size_t size, nlines;
+static size_t *split, *first_line;
+static unsigned char *maxval;
+static volatile uint64_t sink;
+
+// the ceiling: every thread sums its share of the buffer 8 bytes at a time into independent
+// accumulators, which is as little work per byte as a read can take
+static void run_stream(void)
+{
+    uint64_t total = 0;
+    #pragma omp parallel reduction(+:total)
+    {
+        int t = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+        size_t lo = (size / 8) * t / nt, hi = (size / 8) * (t + 1) / nt;
+        const uint64_t *w = (const uint64_t *)buf;
+        uint64_t a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+        size_t i = lo;
+        for (; i + 4 <= hi; i += 4)
+        {
+            a0 += w[i];
+            a1 += w[i + 1];
+            a2 += w[i + 2];
+            a3 += w[i + 3];
+        }
+        for (; i < hi; ++i)
+            a0 += w[i];
+        total += a0 + a1 + a2 + a3;
+    }
+    sink = total;
+}
+
+// the OpenMP version: builds the compact line index in parallel (count, prefix sum, fill), then every
+// thread walks its lines with a cursor through line_max_printable
+static void run_openmp(void)
+{
+    struct line_index idx;
+    size_t *first = malloc((omp_get_max_threads() + 1) * sizeof *first);
+    int failed = 0;
+
+    #pragma omp parallel
+    {
+        int t = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+        size_t lo = size * t / nt, hi = size * (t + 1) / nt;
+
+        first[t + 1] = lineidx_count(buf, lo, hi);
+        #pragma omp barrier
+        #pragma omp single
+        {
+            first[0] = 0;
+            for (int i = 0; i < nt; ++i)
+                first[i + 1] += first[i];
+            failed = lineidx_alloc(&idx, buf, size, first[nt]) != 0;
+        }
+        if (!failed)
+        {
+            lineidx_fill(&idx, lo, hi, first[t]);
+            #pragma omp barrier
+
+            struct line_cursor cur;
+            size_t s, e, llo = idx.nlines * t / nt, lhi = idx.nlines * (t + 1) / nt;
+            lineidx_cursor_init(&cur, &idx, llo);
+            for (size_t i = llo; i < lhi; ++i)
+            {
+                lineidx_next(&cur, &s, &e);
+                maxval[i] = (unsigned char)line_max_printable(buf + s, buf + e);
+            }
+        }
+    }
+
+    if (failed)
+    {
+        fprintf(stderr, "Allocation failure\n");
+        exit(1);
+    }
+    lineidx_free(&idx);
+    free(first);
+}
+
+// the MPI version's scan: no index, each line's end is found with memchr and the line goes through
+// line_max_printable via scan_line_printable
+static void run_mpi(void)
+{
+    #pragma omp parallel
+    {
+        int t = omp_get_thread_num();
+        const char *p = buf + split[t], *e = buf + split[t + 1];
+        size_t line = first_line[t];
+        while (p < e)
+        {
+            unsigned m = 0;
+            const char *nl = scan_line_printable(p, e, &m);
+            maxval[line++] = (unsigned char)m;
+            p = nl + 1;
+        }
+    }
+}
+
+// the same scan without the saturation short-circuit, i.e. what -DNO_SHORT_CIRCUIT compiles to
+static void run_plain(void)
+{
+    #pragma omp parallel
+    {
+        int t = omp_get_thread_num();
+        const char *p = buf + split[t], *e = buf + split[t + 1];
+        size_t line = first_line[t];
+        while (p < e)
+        {
+            const char *nl = memchr(p, '\n', (size_t)(e - p));
+            if (!nl)
+                nl = e;
+            maxval[line++] = (unsigned char)max_printable_run(p, nl, 0);
+            p = nl + 1;
+        }
+    }
+}
+
+// the pthread version's loop: signed compares of every byte, with the newline counting towards the max
+static void run_pthread(void)
+{
+    #pragma omp parallel
+    {
+        int t = omp_get_thread_num();
+        const char *p = buf + split[t], *e = buf + split[t + 1];
+        size_t line = first_line[t];
+        while (p < e)
+        {
+            const char *nl = memchr(p, '\n', (size_t)(e - p));
+            if (!nl)
+                nl = e;
+            int max_value = (nl < buf + size) ? '\n' : 0;
+            for (; p < nl; ++p)
+            {
+                if ((int)*p > max_value)
+                    max_value = *p;
+            }
+            maxval[line++] = (unsigned char)max_value;
+            p = nl + 1;
+        }
+    }
+}
+
+static const struct
+{
+    const char *name;
+    void (*run)(void);
+} variants[NVARIANTS] = {
+    { "stream", run_stream },
+    { "kernel-openmp", run_openmp },
+    { "kernel-mpi", run_mpi },
+    { "kernel-plain", run_plain },
+    { "kernel-pthread", run_pthread },
+};
+
+// reads the first size bytes of path, every thread reading (and so first touching) the share of the
+// buffer it will scan; returns 0 on success
+static int load(const char *path, char *dst)
+{
+    int fd = open(path, O_RDONLY);
+    int failed = 0;
+    if (fd < 0)
+    {
+        perror("open");
+        return -1;
+    }
+    #pragma omp parallel
+    {
+        int t = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+        size_t lo = size * t / nt, hi = size * (t + 1) / nt;
+        while (lo < hi)
+        {
+            ssize_t r = pread(fd, dst + lo, hi - lo, (off_t)lo);
+            if (r <= 0)
+            {
+                #pragma omp atomic write
+                failed = 1;
+                break;
+            }
+            lo += (size_t)r;
+        }
+    }
+    close(fd);
+    if (failed)
+        fprintf(stderr, "%s is shorter than %zu bytes or can't be read\n", path, size);
+    return failed ? -1 : 0;
+}
+
+// cuts the buffer into one line-aligned range per thread and numbers each range's first line (untimed)
+static void make_splits(int nthreads)
+{
+    split = malloc((nthreads + 1) * sizeof *split);
+    first_line = malloc((nthreads + 1) * sizeof *first_line);
+    split[0] = 0;
+    first_line[0] = 0;
+    for (int t = 1; t <= nthreads; ++t)
+    {
+        // a range ends after the first newline at or past its even share of the bytes
+        size_t s = size * t / nthreads;
+        if (s < split[t - 1])
+            s = split[t - 1];
+        if (t == nthreads)
+            s = size;
+        else if (s > 0 && buf[s - 1] != '\n')
+        {
+            const char *nl = memchr(buf + s, '\n', size - s);
+            s = nl ? (size_t)(nl - buf) + 1 : size;
+        }
+        split[t] = s;
+        first_line[t] = first_line[t - 1] + lineidx_count(buf, split[t - 1], s);
+    }
+    nlines = first_line[nthreads] + (buf[size - 1] != '\n');
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long long v, threads, trials = DEFAULT_TRIALS;
+    if (argc < 4 || parse_option_size(argv[2], 8, 1ULL << 40, &v) != 0
+        || parse_option_number(argv[3], 1, 4096, &threads) != 0
+        || (argc > 4 && parse_option_number(argv[4], 1, 1000, &trials) != 0))
+    {
+        fprintf(stderr, "Usage: %s <file> <size> <threads> [trials]\n", argv[0]);
+        return 1;
+    }
+    size = (size_t)v;
+    omp_set_num_threads((int)threads);
+
+    char *data = malloc(size);
+    if (!data || load(argv[1], data) != 0)
+        return 1;
+    buf = data;
+    make_splits((int)threads);
+    maxval = malloc(nlines ? nlines : 1);
+
+    // every variant runs once untimed to warm up, then trials times
+    double mean[NVARIANTS], sd[NVARIANTS], gb = size / 1e9;
+    double *gbps = malloc(trials * sizeof *gbps);
+    for (int k = 0; k < NVARIANTS; ++k)
+    {
+        variants[k].run();
+        double sum = 0, sq = 0;
+        for (unsigned long long r = 0; r < trials; ++r)
+        {
+            double t0 = omp_get_wtime();
+            variants[k].run();
+            gbps[r] = gb / (omp_get_wtime() - t0);
+            sum += gbps[r];
+        }
+        mean[k] = sum / trials;
+        for (unsigned long long r = 0; r < trials; ++r)
+            sq += (gbps[r] - mean[k]) * (gbps[r] - mean[k]);
+        sd[k] = trials > 1 ? sqrt(sq / (trials - 1)) : 0;
+    }
+
+    // the ceiling is the stream variant (k = 0)
+    for (int k = 0; k < NVARIANTS; ++k)
+    {
+        char fn[256];
+        snprintf(fn, sizeof fn, "analysis/%s_%s_%llu_summary.txt", variants[k].name, argv[2], threads);
+        FILE *f = fopen(fn, "w");
+        if (!f)
+        {
+            perror(fn);
+            return 1;
+        }
+        fprintf(f, "Metric      Mean        StdDev\n");
+        fprintf(f, "gbps           %.3f GB/s    %.3f GB/s\n", mean[k], sd[k]);
+        fprintf(f, "pct_peak       %.1f%%       %.1f%%\n", 100 * mean[k] / mean[0], 100 * sd[k] / mean[0]);
+        fclose(f);
+        printf("%-16s %8s %4llu threads %8.2f GB/s %6.1f%% of peak\n", variants[k].name, argv[2], threads,
+               mean[k], 100 * mean[k] / mean[0]);
+    }
+
+    free(gbps);
+    free(maxval);
+    free(split);
+    free(first_line);
+    free(data);
+    return 0;
+}
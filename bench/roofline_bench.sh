@@ -0,0 +1,29 @@
+#!/bin/bash
+# runs the read-bandwidth roofline (roofline.c) over the same size x cores grid as the submit scripts:
+# for every combination it measures the STREAM-like read ceiling and the throughput of every per-line
+# kernel variant on an in-memory copy of the dump prefix, and writes one summary per variant into
+# bench/analysis (metrics gbps and pct_peak), which plot_analysis_info.py picks up like the others
+#
+# usage: ./roofline_bench.sh [dump] [sizes] [cores]    e.g. ./roofline_bench.sh ~dan/625/wiki_dump.txt "60M 720M" "1 8"
+
+# if any command in this script returns a non-zero (i.e. “error”) exit status, immediately stop the script
+set -e
+
+# Go to the directory where this script lives
+cd "$(dirname "$0")"
+
+dump=${1:-~dan/625/wiki_dump.txt}
+sizes=${2:-"60M 120M 240M 720M 1440M 1700M"}
+cores=${3:-"1 2 4 8 16 20"}
+
+mkdir -p build analysis
+gcc -Wall -O2 -fopenmp roofline.c -o build/roofline -lm
+
+# pin the threads so the ceiling and the kernels run on the same cores
+export OMP_PROC_BIND=close OMP_PLACES=cores
+
+for size in $sizes; do
+  for threads in $cores; do
+    build/roofline "$dump" "$size" "$threads"
+  done
+done
@@ -0,0 +1,68 @@
+#!/bin/bash
+# compares the OpenMP and MPI per-line scans with and without the saturation short-circuit from
+# common/kernel.h, on a prefix of the real dump and on a worst-case synthetic file whose lines never
+# reach '}' or '~' (so the short-circuit never fires and only its extra checks are paid for)
+#
+# usage: ./saturation_bench.sh [size] [threads/ranks] [dump]    e.g. ./saturation_bench.sh 240M 8
+
+# if any command in this script returns a non-zero (i.e. “error”) exit status, immediately stop the script
+set -e
+
+# Go to the directory where this script lives
+cd "$(dirname "$0")"
+
+size=${1:-240M}
+threads=${2:-4}
+dump=${3:-~dan/625/wiki_dump.txt}
+trials=5
+
+mkdir -p build analysis
+
+# compile both variants of each implementation
+gcc -Wall -O2 -fopenmp ../3way-openmp/openmp.c -o build/openmp_sc -lm
+gcc -Wall -O2 -fopenmp -DNO_SHORT_CIRCUIT ../3way-openmp/openmp.c -o build/openmp_nosc -lm
+mpicc -Wall -O2 ../3way-MPI/MPI.c -o build/mpi_sc -lm
+mpicc -Wall -O2 -DNO_SHORT_CIRCUIT ../3way-MPI/MPI.c -o build/mpi_nosc -lm
+
+# the real input, and a synthetic one of the same size made of 100-byte lines of bytes 32-124
+real="build/real_${size}.txt"
+synth="build/synthetic_${size}.txt"
+head -c "$size" "$dump" > "$real"
+LC_ALL=C tr -dc ' -|' < /dev/urandom | fold -w 100 | head -c "$size" > "$synth"
+
+# runs a command $trials times and prints the mean wall time in seconds; the openmp executable exits
+# with 1 on success, so the status is ignored
+mean_wall() {
+  local total=0 t0 t1
+  for run in $(seq 1 $trials); do
+    t0=$(date +%s.%N)
+    "$@" > /dev/null || true
+    t1=$(date +%s.%N)
+    total=$(awk -v a="$total" -v b="$t0" -v c="$t1" 'BEGIN{print a + c - b}')
+  done
+  awk -v a="$total" -v n="$trials" 'BEGIN{printf "%.3f", a / n}'
+}
+
+# prints one row of the results table
+row() {
+  awk -v i="$1" -v f="$2" -v p="$3" -v s="$4" 'BEGIN{printf "%-10s %-10s %12s %12s %8.2fx\n", i, f, p, s, p / s}'
+}
+
+out="analysis/saturation_${size}_${threads}.txt"
+printf "%-10s %-10s %12s %12s %9s\n" "impl" "input" "plain_s" "short_s" "speedup" > "$out"
+for input in "$real" "$synth"; do
+  name=$(basename "$input" "_${size}.txt")
+
+  plain=$(OMP_NUM_THREADS="$threads" mean_wall build/openmp_nosc "$input")
+  short=$(OMP_NUM_THREADS="$threads" mean_wall build/openmp_sc "$input")
+  row openmp "$name" "$plain" "$short" >> "$out"
+
+  plain=$(mean_wall mpirun -np "$threads" build/mpi_nosc "$input")
+  short=$(mean_wall mpirun -np "$threads" build/mpi_sc "$input")
+  row mpi "$name" "$plain" "$short" >> "$out"
+done
+
+# remove the input files
+rm -f "$real" "$synth"
+
+cat "$out"
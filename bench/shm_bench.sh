@@ -0,0 +1,45 @@
+#!/bin/bash
+# compares the MPI version's default reads (a private buffer and result array per rank, gathered to
+# rank 0) against --shm (one shared window and result array per node, only node leaders communicating)
+# on a prefix of the dump; --stats reports the slowest rank's phase times and the buffer memory over all
+# ranks, and the wall time is measured around mpirun
+#
+# usage: ./shm_bench.sh [size] [ranks] [dump]    e.g. ./shm_bench.sh 1700M 20
+
+# if any command in this script returns a non-zero (i.e. “error”) exit status, immediately stop the script
+set -e
+
+# Go to the directory where this script lives
+cd "$(dirname "$0")"
+
+size=${1:-240M}
+ranks=${2:-4}
+dump=${3:-~dan/625/wiki_dump.txt}
+trials=5
+
+mkdir -p build analysis
+mpicc -Wall -O2 ../3way-MPI/MPI.c -o build/mpi -lm
+
+input="build/real_${size}.txt"
+head -c "$size" "$dump" > "$input"
+
+# runs one mode $trials times and prints the mean wall time, phase times and buffer sizes
+measure() {
+  for run in $(seq 1 $trials); do
+    t0=$(date +%s.%N)
+    mpirun -np "$ranks" build/mpi --stats "$@" "$input" 2> build/stats.txt > /dev/null
+    t1=$(date +%s.%N)
+    # stats: read+scan S s, collect S s, output S s, input buffers M MB, result arrays M MB
+    awk -v w="$(awk -v a="$t0" -v b="$t1" 'BEGIN{print b - a}')" '/^stats:/ {print w, $3, $6, $9, $13, $17}' build/stats.txt
+  done | awk '{for(i = 1; i <= 6; i++) s[i] += $i} END{for(i = 1; i <= 6; i++) printf " %12.3f", s[i] / NR}'
+}
+
+out="analysis/shm_${size}_${ranks}.txt"
+printf "%-8s %12s %12s %12s %12s %12s %12s\n" "mode" "wall_s" "scan_s" "collect_s" "output_s" "input_mb" "result_mb" > "$out"
+printf "%-8s%s\n" "private" "$(measure)" >> "$out"
+printf "%-8s%s\n" "shm" "$(measure --shm)" >> "$out"
+
+# remove the input file
+rm -f "$input"
+
+cat "$out"
@@ -0,0 +1,54 @@
+#!/bin/bash
+# compares the OpenMP version's plain scan with --xml (only the content of the chosen elements is
+# scanned, after a structural pass over the whole input) on a prefix of the dump: mean wall time and
+# throughput of each, plus the structural pass's own throughput as reported by --stats. Both runs use
+# --summary so the output doesn't dominate the times
+#
+# usage: ./xml_bench.sh [size] [threads] [elements] [dump]    e.g. ./xml_bench.sh 720M 8 title,text
+
+# if any command in this script returns a non-zero (i.e. “error”) exit status, immediately stop the script
+set -e
+
+# Go to the directory where this script lives
+cd "$(dirname "$0")"
+
+size=${1:-240M}
+threads=${2:-4}
+elements=${3:-text}
+dump=${4:-~dan/625/wiki_dump.txt}
+trials=5
+
+mkdir -p build analysis
+gcc -Wall -O2 -fopenmp ../3way-openmp/openmp.c -o build/openmp -lm
+
+# runs a command $trials times and prints the mean wall time in seconds
+mean_wall() {
+  local total=0 t0 t1
+  for run in $(seq 1 $trials); do
+    t0=$(date +%s.%N)
+    "$@" > /dev/null || true
+    t1=$(date +%s.%N)
+    total=$(awk -v a="$total" -v b="$t0" -v c="$t1" 'BEGIN{print a + c - b}')
+  done
+  awk -v a="$total" -v n="$trials" 'BEGIN{printf "%.3f", a / n}'
+}
+
+# the openmp executable exits with 1 on success, so its status is ignored above; warms the page cache
+# so both modes read the input from memory
+head -c "$size" "$dump" > /dev/null
+bytes=$(head -c "$size" "$dump" | wc -c)
+
+export OMP_NUM_THREADS="$threads"
+plain=$(mean_wall build/openmp --summary --limit-bytes="$size" "$dump")
+xml=$(mean_wall build/openmp --summary --xml="$elements" --limit-bytes="$size" "$dump")
+stats=$(build/openmp --summary --stats --xml="$elements" --limit-bytes="$size" "$dump" 2>&1 >/dev/null | grep '^xml:' || true)
+
+out="analysis/xml_${size}_${threads}.txt"
+{
+  printf "%-8s %10s %10s\n" "mode" "wall_s" "MB/s"
+  awk -v w="$plain" -v b="$bytes" 'BEGIN{printf "%-8s %10.3f %10.0f\n", "plain", w, b / 1e6 / w}'
+  awk -v w="$xml" -v b="$bytes" 'BEGIN{printf "%-8s %10.3f %10.0f\n", "xml", w, b / 1e6 / w}'
+  echo "$stats"
+} > "$out"
+
+cat "$out"
@@ -0,0 +1,98 @@
+#ifndef COMMON_AFFINITY_H
+#define COMMON_AFFINITY_H
+
+// needs _GNU_SOURCE, defined at the top of each implementation, for sched_getcpu and the CPU_SET macros
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+///
+/// Pins the calling thread to the index-th CPU it's allowed to run on (wrapping around when there are
+/// fewer CPUs than threads), so the workers of a run stay on distinct cores instead of being migrated
+/// \param index the worker's number: a thread number, or a rank's number within its node
+/// \return the CPU it was pinned to, or -1 if the affinity couldn't be set
+///
+static inline int affinity_pin(int index)
+{
+    cpu_set_t allowed, one;
+    if(sched_getaffinity(0, sizeof allowed, &allowed) != 0 || CPU_COUNT(&allowed) == 0)
+        return -1;
+    int skip = index % CPU_COUNT(&allowed);
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(!CPU_ISSET(cpu, &allowed) || skip-- > 0)
+            continue;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        return sched_setaffinity(0, sizeof one, &one) == 0 ? cpu : -1;
+    }
+    return -1;
+}
+
+///
+/// Current clock of a CPU in MHz: cpufreq's scaling_cur_freq where the kernel has it, otherwise the
+/// "cpu MHz" line of /proc/cpuinfo (which VMs usually fill in with the nominal clock)
+/// \return the clock, or -1 if neither is available
+///
+static inline double affinity_cpu_mhz(int cpu)
+{
+    char path[96], line[256];
+    double mhz = -1;
+    long khz;
+    snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu);
+    FILE *f = fopen(path, "r");
+    if(f)
+    {
+        if(fscanf(f, "%ld", &khz) == 1)
+            mhz = khz / 1000.0;
+        fclose(f);
+        return mhz;
+    }
+
+    f = fopen("/proc/cpuinfo", "r");
+    if(!f)
+        return -1;
+    int current = -1;
+    while(fgets(line, sizeof line, f))
+    {
+        if(!strncmp(line, "processor", 9))
+            sscanf(strchr(line, ':') + 1, "%d", &current);
+        else if(current == cpu && !strncmp(line, "cpu MHz", 7))
+        {
+            sscanf(strchr(line, ':') + 1, "%lf", &mhz);
+            break;
+        }
+    }
+    fclose(f);
+    return mhz;
+}
+
+///
+/// Prints the placement of a run's workers as a CSV row on stderr: "affinity,<cpus>,<mhz>", where cpus
+/// lists the CPU each worker was on, separated by ';', and mhz is the mean clock of those CPUs (NA if
+/// it isn't known)
+/// \param cpus the CPU of each worker, -1 where it's unknown
+/// \param mhz the clock of each worker's CPU, -1 where it's unknown
+/// \param n number of workers
+///
+static inline void affinity_report(const int *cpus, const double *mhz, int n)
+{
+    double sum = 0;
+    int known = 0;
+    fprintf(stderr, "affinity,");
+    for(int i = 0; i < n; i++)
+    {
+        fprintf(stderr, i ? ";%d" : "%d", cpus[i]);
+        if(mhz[i] >= 0)
+        {
+            sum += mhz[i];
+            known++;
+        }
+    }
+    if(known)
+        fprintf(stderr, ",%.0f\n", sum / known);
+    else
+        fprintf(stderr, ",NA\n");
+}
+
+#endif
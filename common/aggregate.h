@@ -0,0 +1,161 @@
+#ifndef COMMON_AGGREGATE_H
+#define COMMON_AGGREGATE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+///
+/// Histogram of per-line maximum values. Every worker fills its own and they're summed at the end,
+/// the same way examples/pt1.c keeps a local_char_count per thread
+///
+struct histogram
+{
+    unsigned long long count[256];
+};
+
+///
+/// One line kept by a top-K heap
+///
+struct topk_entry
+{
+    unsigned value;
+    unsigned long long line;
+};
+
+///
+/// The K lines with the highest values; ties go to the lower line number so every backend and thread
+/// count picks the same lines. Stored as a min-heap whose root is the weakest line kept so far
+///
+struct topk
+{
+    size_t k;
+    size_t n;
+    struct topk_entry *heap;
+};
+
+static inline void hist_init(struct histogram *h)
+{
+    memset(h, 0, sizeof *h);
+}
+
+static inline void hist_add(struct histogram *h, unsigned value)
+{
+    h->count[value & 0xff]++;
+}
+
+static inline void hist_merge(struct histogram *dst, const struct histogram *src)
+{
+    for(int v = 0; v < 256; v++)
+        dst->count[v] += src->count[v];
+}
+
+///
+/// Prints the total number of lines, then "value: lines" for every value that occurred
+///
+static inline void hist_print(const struct histogram *h)
+{
+    unsigned long long total = 0;
+    for(int v = 0; v < 256; v++)
+        total += h->count[v];
+    printf("lines: %llu\n", total);
+    for(int v = 0; v < 256; v++)
+    {
+        if(h->count[v])
+            printf("%d: %llu\n", v, h->count[v]);
+    }
+}
+
+///
+/// Allocates a heap for the k best lines
+/// \return 0 on success, -1 if the allocation failed
+///
+static inline int topk_init(struct topk *t, size_t k)
+{
+    t->k = k;
+    t->n = 0;
+    t->heap = malloc((k ? k : 1) * sizeof *t->heap);
+    return t->heap ? 0 : -1;
+}
+
+static inline void topk_free(struct topk *t)
+{
+    free(t->heap);
+    t->heap = NULL;
+}
+
+// true when a ranks below b: a lower value, or the same value on a later line
+static inline int topk_less(const struct topk_entry *a, const struct topk_entry *b)
+{
+    return a->value < b->value || (a->value == b->value && a->line > b->line);
+}
+
+static inline void topk_sift_down(struct topk *t, size_t i)
+{
+    for(;;)
+    {
+        size_t l = 2 * i + 1, r = l + 1, m = i;
+        if(l < t->n && topk_less(&t->heap[l], &t->heap[m]))
+            m = l;
+        if(r < t->n && topk_less(&t->heap[r], &t->heap[m]))
+            m = r;
+        if(m == i)
+            return;
+        struct topk_entry tmp = t->heap[i];
+        t->heap[i] = t->heap[m];
+        t->heap[m] = tmp;
+        i = m;
+    }
+}
+
+///
+/// Offers a line to the heap; it's kept if fewer than k lines are held or it beats the weakest one
+///
+static inline void topk_push(struct topk *t, unsigned value, unsigned long long line)
+{
+    struct topk_entry e = { value, line };
+    if(t->n < t->k)
+    {
+        // sift the new entry up from the bottom
+        size_t i = t->n++;
+        while(i && topk_less(&e, &t->heap[(i - 1) / 2]))
+        {
+            t->heap[i] = t->heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        t->heap[i] = e;
+    }
+    else if(t->k && topk_less(&t->heap[0], &e))
+    {
+        t->heap[0] = e;
+        topk_sift_down(t, 0);
+    }
+}
+
+static inline void topk_merge(struct topk *dst, const struct topk *src)
+{
+    for(size_t i = 0; i < src->n; i++)
+        topk_push(dst, src->heap[i].value, src->heap[i].line);
+}
+
+static inline int topk_compare_desc(const void *a, const void *b)
+{
+    const struct topk_entry *x = a, *y = b;
+    if(topk_less(x, y))
+        return 1;
+    if(topk_less(y, x))
+        return -1;
+    return 0;
+}
+
+///
+/// Prints the kept lines best first, in the same "N: V" format as the full output (the heap is sorted in place)
+///
+static inline void topk_print(struct topk *t)
+{
+    qsort(t->heap, t->n, sizeof *t->heap, topk_compare_desc);
+    for(size_t i = 0; i < t->n; i++)
+        printf("%llu: %u\n", t->heap[i].line, t->heap[i].value);
+}
+
+#endif
@@ -0,0 +1,292 @@
+#ifndef COMMON_APPROX_H
+#define COMMON_APPROX_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "kernel.h"
+
+// --approx reads the input in blocks of APPROX_MIN_BLOCK to APPROX_MAX_BLOCK bytes, sized so that at least
+// APPROX_MIN_SAMPLES blocks are sampled where the input allows it; fewer, larger blocks are cheaper to read,
+// more of them give a better variance estimate
+#define APPROX_MIN_SAMPLES 32
+#define APPROX_MIN_BLOCK (64 << 10)
+#define APPROX_MAX_BLOCK (1 << 20)
+
+// bytes read at a time to finish a line that runs past the end of its block
+#define APPROX_TAIL (64 << 10)
+
+// z value of the two-sided 95% confidence intervals
+#define APPROX_Z 1.96
+
+// the totals estimated from each block: the number of lines with each value, and at APPROX_LINES the
+// number of lines counted (those at or above --min-value)
+#define APPROX_LINES 256
+#define APPROX_VARS 257
+
+///
+/// Which blocks of the input --approx reads. The input is cut into nblocks full blocks of block bytes and
+/// nsampled of them are picked uniformly at random without replacement. A block owns the lines that start
+/// in it, so every line belongs to exactly one block and the sum over the sampled blocks, scaled by
+/// nblocks / nsampled, is an unbiased estimate of the total. The shorter block left at the end (block
+/// number nblocks, if the size isn't a multiple of block) would add much of the variance if it were
+/// sampled like the others, so it's always read and counted exactly
+///
+struct approx_plan
+{
+    size_t block;
+    size_t nblocks;
+    size_t nsampled;
+    size_t nread;       // nsampled, plus the last block if it's a short one
+    size_t *sampled;    // the numbers of the nread blocks to read, in ascending order
+};
+
+///
+/// Sums over the sampled blocks of each block's totals and of their squares, from which the estimates
+/// and their variance follow, and the exact totals of the short last block; kept per worker and added up
+/// at the end
+///
+struct approx_sums
+{
+    unsigned long long blocks;
+    unsigned long long s1[APPROX_VARS];
+    double s2[APPROX_VARS];
+    unsigned long long tail[APPROX_VARS];
+};
+
+///
+/// Picks the blocks to sample from size bytes, about fraction of the full ones, with Knuth's selection sampling
+/// (algorithm S) driven by a xorshift64* generator seeded with seed, so every rank of an MPI run that
+/// passes the same seed gets the same plan
+/// \return 0 on success, -1 if the list couldn't be allocated
+///
+static inline int approx_plan_init(struct approx_plan *pl, unsigned long long size, double fraction,
+                                   unsigned long long seed)
+{
+    double target = fraction * (double)size / APPROX_MIN_SAMPLES;
+    size_t block = target > APPROX_MAX_BLOCK ? APPROX_MAX_BLOCK : target < APPROX_MIN_BLOCK ? APPROX_MIN_BLOCK
+                                                                                              : (size_t)target;
+    block &= ~(size_t)4095;
+    pl->block = block;
+    pl->nblocks = (size_t)(size / block);
+    pl->nsampled = (size_t)ceil(fraction * (double)pl->nblocks);
+    if(pl->nsampled < 1)
+        pl->nsampled = 1;
+    if(pl->nsampled > pl->nblocks)
+        pl->nsampled = pl->nblocks;
+    pl->nread = pl->nsampled + (size % block != 0);
+    pl->sampled = malloc((pl->nread ? pl->nread : 1) * sizeof *pl->sampled);
+    if(!pl->sampled)
+        return -1;
+
+    uint64_t x = seed * 0x9E3779B97F4A7C15ULL + 1;
+    size_t picked = 0;
+    for(size_t b = 0; b < pl->nblocks && picked < pl->nsampled; b++)
+    {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        double u = (double)((x * 0x2545F4914F6CDD1DULL) >> 11) / 9007199254740992.0;
+        // block b is picked with probability (still needed) / (still left)
+        if(u * (double)(pl->nblocks - b) < (double)(pl->nsampled - picked))
+            pl->sampled[picked++] = b;
+    }
+    if(pl->nread > pl->nsampled)
+        pl->sampled[picked] = pl->nblocks;
+    return 0;
+}
+
+static inline void approx_plan_free(struct approx_plan *pl)
+{
+    free(pl->sampled);
+    pl->sampled = NULL;
+}
+
+// pread until len bytes are read or the file ends; returns the bytes read, or -1 on an error
+static inline ssize_t approx_read(int fd, char *buf, size_t len, unsigned long long off)
+{
+    size_t got = 0;
+    while(got < len)
+    {
+        ssize_t r = pread(fd, buf + got, len - got, (off_t)(off + got));
+        if(r < 0)
+        {
+            perror("pread");
+            return -1;
+        }
+        if(r == 0)
+            break;
+        got += (size_t)r;
+    }
+    return (ssize_t)got;
+}
+
+///
+/// Reads block b with pread and counts the lines it owns by value: the lines that start in it, the last
+/// of which is read on past the block's end until its newline. The byte before the block is read as well,
+/// to tell whether the first line starts there or is the rest of a line owned by an earlier block. So
+/// that the reads stay bounded by the sample, a sampled block reads at most one more block past its end,
+/// and a line that runs on further is counted with the maximum of its bytes up to there; when every
+/// block is read anyway (--approx=1), lines are read to their end and the counts are exact
+/// \param fd the input, of which only the first size bytes count (--limit-bytes)
+/// \param buf a buffer of at least block + 1 and APPROX_TAIL bytes
+/// \param counts receives the block's totals, see APPROX_VARS
+/// \return 0 on success, -1 if the block couldn't be read
+///
+static inline int approx_block_counts(int fd, const struct approx_plan *pl, unsigned long long size, size_t b,
+                                      const struct byte_class *bc, unsigned min_value, char *buf,
+                                      unsigned long long *counts)
+{
+    unsigned long long lo = (unsigned long long)b * pl->block;
+    unsigned long long hi = size - lo < pl->block ? size : lo + pl->block;
+    unsigned long long reach = pl->nsampled == pl->nblocks || size - hi < pl->block ? size : hi + pl->block;
+    unsigned long long base = lo ? lo - 1 : 0;
+    ssize_t n = approx_read(fd, buf, (size_t)(hi - base), base);
+    if(n < 0)
+        return -1;
+    memset(counts, 0, APPROX_VARS * sizeof *counts);
+
+    size_t p = 0;
+    if(lo)
+    {
+        const char *nl = memchr(buf, '\n', (size_t)n);
+        if(!nl)
+            return 0;
+        p = (size_t)(nl - buf) + 1;
+    }
+
+    unsigned m = 0;
+    int open = 0;   // the current line started in an earlier read
+    while(open || base + p < hi)
+    {
+        const char *nl = memchr(buf + p, '\n', (size_t)n - p);
+        unsigned v = line_max_in_class(bc, buf + p, nl ? nl : buf + n);
+        if(v > m)
+            m = v;
+
+        if(!nl)
+        {
+            // the line runs on past what's been read, so the next bytes are read over the old ones
+            if(base + (unsigned long long)n < reach)
+            {
+                base += (unsigned long long)n;
+                size_t want = reach - base < APPROX_TAIL ? (size_t)(reach - base) : APPROX_TAIL;
+                if((n = approx_read(fd, buf, want, base)) <= 0)
+                    return -1;
+                p = 0;
+                open = 1;
+                continue;
+            }
+            // the input ends without a newline (its last line counts if it has any bytes), or the line is
+            // cut off at reach
+            if(!open && p == (size_t)n)
+                break;
+        }
+
+        if(m >= min_value)
+        {
+            counts[m]++;
+            counts[APPROX_LINES]++;
+        }
+        if(!nl)
+            break;
+        p = (size_t)(nl - buf) + 1;
+        m = 0;
+        open = 0;
+    }
+    return 0;
+}
+
+static inline void approx_sums_init(struct approx_sums *s)
+{
+    memset(s, 0, sizeof *s);
+}
+
+// adds the totals of block b, a sampled one or the short last one
+static inline void approx_sums_add(struct approx_sums *s, const struct approx_plan *pl, size_t b,
+                                   const unsigned long long *counts)
+{
+    if(b == pl->nblocks)
+    {
+        memcpy(s->tail, counts, sizeof s->tail);
+        return;
+    }
+    s->blocks++;
+    for(int i = 0; i < APPROX_VARS; i++)
+    {
+        s->s1[i] += counts[i];
+        s->s2[i] += (double)counts[i] * (double)counts[i];
+    }
+}
+
+static inline void approx_sums_merge(struct approx_sums *dst, const struct approx_sums *src)
+{
+    dst->blocks += src->blocks;
+    for(int i = 0; i < APPROX_VARS; i++)
+    {
+        dst->s1[i] += src->s1[i];
+        dst->s2[i] += src->s2[i];
+        dst->tail[i] += src->tail[i];
+    }
+}
+
+///
+/// Prints the estimate of total i and the half-width of its 95% confidence interval: N / n times the
+/// sampled sum plus the last block's exact count, with the variance of the block totals scaled up the same
+/// way and corrected for sampling without replacement (so sampling every block gives the exact count and
+/// an interval of 0). With fewer than two sampled blocks, or none that differ, the interval is NA
+///
+static inline void approx_print_estimate(const struct approx_plan *pl, const struct approx_sums *s, int i,
+                                         const char *label)
+{
+    double n = (double)s->blocks, N = (double)pl->nblocks;
+    double estimate = (n ? s->s1[i] * N / n : 0) + s->tail[i];
+    if(s->blocks == pl->nblocks)
+    {
+        printf("%s: %.0f +- 0\n", label, estimate);
+        return;
+    }
+    if(s->blocks < 2)
+    {
+        printf("%s: %.0f +- NA\n", label, estimate);
+        return;
+    }
+    double mean = s->s1[i] / n;
+    double var = (s->s2[i] - n * mean * mean) / (n - 1);
+
+    // blocks that all agree (often none of them holding the value at all) say nothing about the blocks
+    // that weren't read, so no interval is given rather than one of 0; the margin absorbs rounding
+    if(var <= 1e-9 * s->s2[i] / n)
+    {
+        printf("%s: %.0f +- NA\n", label, estimate);
+        return;
+    }
+    printf("%s: %.0f +- %.0f\n", label, estimate, APPROX_Z * N * sqrt((1 - n / N) * var / n));
+}
+
+///
+/// Prints what --approx found, in the layout of --summary: a header line with the sample, "lines: N +- E"
+/// and "value: N +- E" for every value seen in the sample, where E is the half-width of the 95%
+/// confidence interval
+///
+static inline void approx_print(const struct approx_plan *pl, const struct approx_sums *s, unsigned long long size)
+{
+    char label[8];
+    unsigned long long read = (unsigned long long)pl->nsampled * pl->block + size % pl->block;
+    printf("approx: %zu of %zu blocks of %zu bytes sampled (%.2f%% of the input), 95%% confidence intervals\n",
+           pl->nsampled, pl->nblocks, pl->block, 100.0 * read / (size ? size : 1));
+    approx_print_estimate(pl, s, APPROX_LINES, "lines");
+    for(int v = 0; v < 256; v++)
+    {
+        if(!s->s1[v] && !s->tail[v])
+            continue;
+        snprintf(label, sizeof label, "%d", v);
+        approx_print_estimate(pl, s, v, label);
+    }
+}
+
+#endif
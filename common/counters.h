@@ -0,0 +1,171 @@
+#ifndef COMMON_COUNTERS_H
+#define COMMON_COUNTERS_H
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+///
+/// The events counted by --counters, in the order of the CSV columns
+///
+enum counter_id
+{
+    CTR_TASK_CLOCK,       // CPU time in ns, what perf stat reports as task-clock
+    CTR_CYCLES,
+    CTR_INSTRUCTIONS,
+    CTR_LLC_MISSES,       // the generic cache-misses event, which is last-level cache misses
+    CTR_BRANCH_MISSES,
+    CTR_DTLB_MISSES,      // data TLB read misses
+    CTR_PAGE_FAULTS,
+    NCOUNTERS
+};
+
+///
+/// One thread's counters. They count only the thread that opened them, but any thread of the process
+/// can read them, so a phase can be measured by reading every worker's counters from the main thread
+///
+struct counters
+{
+    int fd[NCOUNTERS];                  // -1 where the kernel or the hardware doesn't support the event
+    unsigned long long last[NCOUNTERS]; // values at the previous counters_take
+};
+
+///
+/// Counter values summed over threads (and ranks) for one phase
+///
+struct counter_totals
+{
+    unsigned long long v[NCOUNTERS];
+    unsigned long long seen[NCOUNTERS]; // non-zero if any thread had the event open
+};
+
+// CSV column name of each event
+static inline const char *counter_name(int id)
+{
+    static const char *const names[NCOUNTERS] = {
+        "task_clock_ms", "cycles", "instructions", "llc_misses", "branch_misses", "dtlb_misses", "page_faults"
+    };
+    return names[id];
+}
+
+///
+/// Opens the counters of the calling thread, counting user-space work from now on; events that can't be
+/// opened are left out (a VM often has no hardware counters, but the software ones always work)
+///
+static inline void counters_open(struct counters *c)
+{
+    static const struct { unsigned type; unsigned long long config; } events[NCOUNTERS] = {
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                              | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    };
+
+    for(int i = 0; i < NCOUNTERS; i++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        // more hardware events than the PMU has registers get multiplexed; the enabled and running
+        // times let counters_take scale the counts back up
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        c->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        c->last[i] = 0;
+    }
+}
+
+///
+/// Adds what the thread's counters counted since the last call (or since counters_open) to t; safe to
+/// call from several threads on the same totals
+///
+static inline void counters_take(struct counters *c, struct counter_totals *t)
+{
+    for(int i = 0; i < NCOUNTERS; i++)
+    {
+        unsigned long long r[3]; // value, time enabled, time running
+        if(c->fd[i] < 0 || read(c->fd[i], r, sizeof r) != (ssize_t)sizeof r)
+            continue;
+        unsigned long long now = r[0];
+        if(r[2] && r[2] < r[1])
+            now = (unsigned long long)((double)r[0] * r[1] / r[2]);
+        // scaled estimates of a multiplexed event can come out slightly lower than the previous one
+        __atomic_fetch_add(&t->v[i], now > c->last[i] ? now - c->last[i] : 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&t->seen[i], 1, __ATOMIC_RELAXED);
+        c->last[i] = now;
+    }
+}
+
+static inline void counters_close(struct counters *c)
+{
+    for(int i = 0; i < NCOUNTERS; i++)
+    {
+        if(c->fd[i] >= 0)
+            close(c->fd[i]);
+        c->fd[i] = -1;
+    }
+}
+
+///
+/// Prints the header of the --counters report on stderr: "counters,phase," and the event names
+///
+static inline void counters_print_header(void)
+{
+    fprintf(stderr, "counters,phase");
+    for(int i = 0; i < NCOUNTERS; i++)
+        fprintf(stderr, ",%s", counter_name(i));
+    fprintf(stderr, "\n");
+}
+
+///
+/// Prints one phase's totals as a CSV row on stderr, NA for the events nobody could count (seen)
+///
+static inline void counters_print(const char *phase, const struct counter_totals *t, const unsigned long long *seen)
+{
+    fprintf(stderr, "counters,%s", phase);
+    for(int i = 0; i < NCOUNTERS; i++)
+    {
+        if(!seen[i])
+            fprintf(stderr, ",NA");
+        else if(i == CTR_TASK_CLOCK)
+            fprintf(stderr, ",%.2f", t->v[i] / 1e6);
+        else
+            fprintf(stderr, ",%llu", t->v[i]);
+    }
+    fprintf(stderr, "\n");
+}
+
+///
+/// Prints the header, a row per phase and a "total" row summing them
+///
+static inline void counters_report(const char *const *phase_names, const struct counter_totals *phases, int nphases)
+{
+    struct counter_totals total;
+    memset(&total, 0, sizeof total);
+    for(int p = 0; p < nphases; p++)
+    {
+        for(int i = 0; i < NCOUNTERS; i++)
+        {
+            total.v[i] += phases[p].v[i];
+            total.seen[i] |= phases[p].seen[i];
+        }
+    }
+
+    // a phase that didn't happen in this mode shows up as zeros
+    counters_print_header();
+    for(int p = 0; p < nphases; p++)
+        counters_print(phase_names[p], &phases[p], total.seen);
+    counters_print("total", &total, total.seen);
+}
+
+#endif
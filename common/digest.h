@@ -0,0 +1,86 @@
+#ifndef COMMON_DIGEST_H
+#define COMMON_DIGEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// the 64-bit primes of xxHash64
+#define DIGEST_PRIME1 0x9E3779B185EBCA87ULL
+#define DIGEST_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define DIGEST_PRIME3 0x165667B19E3779F9ULL
+#define DIGEST_PRIME5 0x27D4EB2F165667C5ULL
+
+///
+/// Order-dependent hash of the (line, value) stream, for comparing the output of two runs without
+/// diffing it. Each pair goes through an xxHash64 round and is folded in as acc = acc * PRIME1 + round,
+/// i.e. the digest is a polynomial in the rounds. A worker's range can then be hashed on its own and the
+/// partial digests combined afterwards in line order (see digest_merge), which gives the same digest for
+/// any number of threads or ranks
+///
+struct digest
+{
+    uint64_t acc;
+    unsigned long long lines;   // pairs hashed so far
+};
+
+static inline void digest_init(struct digest *d)
+{
+    d->acc = 0;
+    d->lines = 0;
+}
+
+// the xxHash64 round applied to one pair; the value sits in the low byte, the line number above it
+static inline uint64_t digest_round(unsigned long long line, unsigned value)
+{
+    uint64_t k = ((uint64_t)line << 8 | (value & 0xff)) * DIGEST_PRIME2;
+    k = (k << 31) | (k >> 33);
+    return k * DIGEST_PRIME1;
+}
+
+static inline void digest_add(struct digest *d, unsigned long long line, unsigned value)
+{
+    d->acc = d->acc * DIGEST_PRIME1 + digest_round(line, value);
+    d->lines++;
+}
+
+///
+/// Appends the pairs hashed into src to dst, as if they had been added to dst one by one; src must
+/// cover the lines right after dst's
+///
+static inline void digest_merge(struct digest *dst, const struct digest *src)
+{
+    // PRIME1 to the power of src->lines, by squaring
+    uint64_t pow = 1, base = DIGEST_PRIME1;
+    for(unsigned long long n = src->lines; n; n >>= 1)
+    {
+        if(n & 1)
+            pow *= base;
+        base *= base;
+    }
+    dst->acc = dst->acc * pow + src->acc;
+    dst->lines += src->lines;
+}
+
+///
+/// The final digest: the line count is mixed in and the result goes through xxHash64's avalanche
+///
+static inline uint64_t digest_value(const struct digest *d)
+{
+    uint64_t h = d->acc ^ (d->lines * DIGEST_PRIME5);
+    h ^= h >> 33;
+    h *= DIGEST_PRIME2;
+    h ^= h >> 29;
+    h *= DIGEST_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+///
+/// Prints "digest: <16 hex digits> lines: N"
+///
+static inline void digest_print(const struct digest *d)
+{
+    printf("digest: %016llx lines: %llu\n", (unsigned long long)digest_value(d), d->lines);
+}
+
+#endif
@@ -0,0 +1,291 @@
+#ifndef COMMON_KERNEL_H
+#define COMMON_KERNEL_H
+
+#include <string.h>
+
+// the printable filter used by the OpenMP and MPI versions keeps bytes 32-126, so once a line's maximum
+// reaches 126 ('~') no later byte can raise it
+#define PRINTABLE_MIN 32
+#define PRINTABLE_MAX 126
+
+// compiling with -DNO_SHORT_CIRCUIT turns the saturation checks off, which is what the benchmark in
+// bench/saturation_bench.sh compares against
+
+// bytes scanned between saturation checks; checking once per block keeps the inner loop branch-free
+#define SATURATION_BLOCK 64
+
+// lines longer than SPLIT_LINE_BYTES are cut into pieces of SPLIT_PIECE_BYTES that idle threads scan
+// alongside the thread the line was assigned to, and the pieces' maxima are combined with a max
+// reduction; otherwise one multi-megabyte line keeps a single thread busy while the others wait
+#ifndef SPLIT_LINE_BYTES
+#define SPLIT_LINE_BYTES (1 << 20)
+#endif
+#ifndef SPLIT_PIECE_BYTES
+#define SPLIT_PIECE_BYTES (256 << 10)
+#endif
+
+///
+/// The byte classes --class selects from. A line's value is the largest value any of its bytes has in the
+/// class, and bytes outside the class count as 0
+///
+enum class_id
+{
+    CLASS_PRINTABLE,    // bytes 32-126, the default of the OpenMP and MPI versions
+    CLASS_ASCII,        // bytes 0-127
+    CLASS_ALNUM,        // 0-9, A-Z and a-z
+    CLASS_LETTERS,      // A-Z and a-z, case-folded: 'A' counts as 'a'
+    CLASS_SET,          // a custom set of bytes, "set:" followed by the bytes and ranges such as a-z
+    NCLASSES
+};
+
+///
+/// A byte class: which one, and the value of every byte in it, which is what the kernels of the classes
+/// made of several ranges look up; the single-range classes use compares instead, see class_value
+///
+struct byte_class
+{
+    int id;
+    unsigned char value[256];   // value[c]: c's value in the class, 0 for bytes outside it
+    unsigned top;               // the largest value in the class; a line that reaches it is done
+    unsigned below;             // the largest value under top
+};
+
+///
+/// Sets up the class named by spec ("printable", "ascii", "alnum", "letters" or "set:BYTES"), or the
+/// printable class if spec is NULL. In a set, "x-y" is the range of bytes from x to y; a '-' at the start
+/// or the end of the set stands for itself
+/// \return 0 on success, -1 if spec isn't a class or names an empty set
+///
+static inline int byte_class_init(struct byte_class *bc, const char *spec)
+{
+    static const char *const names[CLASS_SET] = { "printable", "ascii", "alnum", "letters" };
+    if(!spec)
+        spec = names[CLASS_PRINTABLE];
+    memset(bc->value, 0, sizeof bc->value);
+    bc->id = -1;
+    for(int i = 0; i < CLASS_SET; i++)
+    {
+        if(!strcmp(spec, names[i]))
+            bc->id = i;
+    }
+
+    for(int c = 0; c < 256; c++)
+    {
+        switch(bc->id)
+        {
+        case CLASS_PRINTABLE:
+            bc->value[c] = (c >= PRINTABLE_MIN && c <= PRINTABLE_MAX) ? c : 0;
+            break;
+        case CLASS_ASCII:
+            bc->value[c] = c < 128 ? c : 0;
+            break;
+        case CLASS_ALNUM:
+            bc->value[c] = ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')) ? c : 0;
+            break;
+        case CLASS_LETTERS:
+            bc->value[c] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : (c >= 'a' && c <= 'z') ? c : 0;
+            break;
+        }
+    }
+
+    if(bc->id < 0)
+    {
+        if(strncmp(spec, "set:", 4) != 0)
+            return -1;
+        bc->id = CLASS_SET;
+        const unsigned char *b = (const unsigned char *)spec + 4;
+        for(size_t i = 0; b[i]; i++)
+        {
+            unsigned lo = b[i], hi = b[i];
+            if(b[i + 1] == '-' && b[i + 2])
+            {
+                hi = b[i + 2];
+                i += 2;
+            }
+            for(unsigned c = lo; c <= hi; c++)
+                bc->value[c] = (unsigned char)c;
+        }
+    }
+
+    // a line never holds a newline, so it can't be in the class
+    bc->value['\n'] = 0;
+    bc->top = bc->below = 0;
+    for(int c = 0; c < 256; c++)
+    {
+        if(bc->value[c] > bc->top)
+            bc->top = bc->value[c];
+    }
+    for(int c = 0; c < 256; c++)
+    {
+        if(bc->value[c] > bc->below && bc->value[c] < bc->top)
+            bc->below = bc->value[c];
+    }
+    return bc->top ? 0 : -1;
+}
+
+// the kernels below take the class id as a compile-time constant and are always inlined, so every call
+// with a constant id becomes a loop of its own with the class test and the saturation values built in,
+// instead of a switch per byte
+#define CLASS_KERNEL static inline __attribute__((always_inline))
+
+///
+/// Value of byte c in class id. A single range is two compares (bc isn't read, so the printable
+/// wrappers below pass NULL); classes made of several ranges look the byte up in bc->value instead,
+/// since one load per byte is cheaper than a compare per range
+///
+CLASS_KERNEL unsigned char class_value(int id, const struct byte_class *bc, unsigned char c)
+{
+    switch(id)
+    {
+    case CLASS_PRINTABLE:
+        return (c >= PRINTABLE_MIN && c <= PRINTABLE_MAX) ? c : 0;
+    case CLASS_ASCII:
+        return c < 128 ? c : 0;
+    default:
+        return bc->value[c];
+    }
+}
+
+// the largest value of class id and the largest one under it, constants for the built-in classes
+CLASS_KERNEL unsigned class_top(int id, const struct byte_class *bc)
+{
+    switch(id)
+    {
+    case CLASS_PRINTABLE:
+        return PRINTABLE_MAX;
+    case CLASS_ASCII:
+        return 127;
+    case CLASS_ALNUM:
+    case CLASS_LETTERS:
+        return 'z';
+    default:
+        return bc->top;
+    }
+}
+
+CLASS_KERNEL unsigned class_below(int id, const struct byte_class *bc)
+{
+    switch(id)
+    {
+    case CLASS_PRINTABLE:
+        return PRINTABLE_MAX - 1;
+    case CLASS_ASCII:
+        return 126;
+    case CLASS_ALNUM:
+    case CLASS_LETTERS:
+        return 'y';
+    default:
+        return bc->below;
+    }
+}
+
+// whether [p, e) holds a byte whose value is the class's top: one memchr, or two for the case-folded 'z'
+CLASS_KERNEL int class_has_top(int id, const struct byte_class *bc, const char *p, const char *e)
+{
+    if(id == CLASS_LETTERS && memchr(p, 'Z', (size_t)(e - p)))
+        return 1;
+    return memchr(p, (int)class_top(id, bc), (size_t)(e - p)) != NULL;
+}
+
+///
+/// Maximum value of the bytes in [p, e) in class id, folded into m; written without branches so the
+/// compiler can turn it into compares and max instructions
+///
+CLASS_KERNEL unsigned max_class_run(int id, const struct byte_class *bc, const char *p, const char *e, unsigned m)
+{
+    unsigned char cur = (unsigned char)m;
+    for(; p < e; p++)
+    {
+        unsigned char v = class_value(id, bc, (unsigned char)*p);
+        cur = v > cur ? v : cur;
+    }
+    return cur;
+}
+
+///
+/// Retrieves the maximum value in class id of the bytes in [p, e), which must not contain a newline. The
+/// line is scanned in blocks; once the maximum reaches the value under the class's top the only thing
+/// left to find out is whether a byte with the top value follows, which memchr answers with a vectorized
+/// search
+///
+CLASS_KERNEL unsigned line_max_class(int id, const struct byte_class *bc, const char *p, const char *e)
+{
+    unsigned m = 0;
+#ifndef NO_SHORT_CIRCUIT
+    unsigned top = class_top(id, bc);
+    while(e - p > SATURATION_BLOCK)
+    {
+        m = max_class_run(id, bc, p, p + SATURATION_BLOCK, m);
+        p += SATURATION_BLOCK;
+        if(m >= class_below(id, bc))
+        {
+            if(m == top || class_has_top(id, bc, p, e))
+                return top;
+            return m;
+        }
+    }
+#endif
+    return max_class_run(id, bc, p, e, m);
+}
+
+///
+/// Scans forward from p until a newline or e, raising *m to the largest value in class id seen. Used
+/// where line ends aren't known in advance: the newline is found first with memchr, so the line itself
+/// goes through line_max_class and its saturation checks. *m carries a line's maximum over from one
+/// call to the next when a line runs past e
+/// \return the position of the newline that ended the line, or e if the line runs past e
+///
+CLASS_KERNEL const char *scan_line_class(int id, const struct byte_class *bc, const char *p, const char *e,
+                                         unsigned *m)
+{
+    const char *nl = memchr(p, '\n', (size_t)(e - p));
+    if(!nl)
+        nl = e;
+#ifndef NO_SHORT_CIRCUIT
+    if(*m == class_top(id, bc))
+        return nl;
+#endif
+    unsigned v = line_max_class(id, bc, p, nl);
+    if(v > *m)
+        *m = v;
+    return nl;
+}
+
+///
+/// line_max_class for a class chosen at run time: one switch per call picks the specialized kernel,
+/// for the places that scan a line or a piece at a time rather than a whole range of lines
+///
+static inline unsigned line_max_in_class(const struct byte_class *bc, const char *p, const char *e)
+{
+    switch(bc->id)
+    {
+    case CLASS_PRINTABLE:
+        return line_max_class(CLASS_PRINTABLE, bc, p, e);
+    case CLASS_ASCII:
+        return line_max_class(CLASS_ASCII, bc, p, e);
+    case CLASS_ALNUM:
+        return line_max_class(CLASS_ALNUM, bc, p, e);
+    case CLASS_LETTERS:
+        return line_max_class(CLASS_LETTERS, bc, p, e);
+    default:
+        return line_max_class(CLASS_SET, bc, p, e);
+    }
+}
+
+// the printable class's kernels under the names the benchmarks use
+static inline unsigned max_printable_run(const char *p, const char *e, unsigned m)
+{
+    return max_class_run(CLASS_PRINTABLE, NULL, p, e, m);
+}
+
+static inline unsigned line_max_printable(const char *p, const char *e)
+{
+    return line_max_class(CLASS_PRINTABLE, NULL, p, e);
+}
+
+static inline const char *scan_line_printable(const char *p, const char *e, unsigned *m)
+{
+    return scan_line_class(CLASS_PRINTABLE, NULL, p, e, m);
+}
+
+#endif
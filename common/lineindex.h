@@ -0,0 +1,200 @@
+#ifndef COMMON_LINEINDEX_H
+#define COMMON_LINEINDEX_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the buffer is cut into blocks of 2^32 bytes so every newline position fits in a 32-bit offset from
+// the start of its block; anything up to 4 GiB is a single block
+#define LINEIDX_BLOCK_SHIFT 32
+#define LINEIDX_BLOCK_MASK ((((size_t)1) << LINEIDX_BLOCK_SHIFT) - 1)
+
+///
+/// Compact line index over one contiguous buffer. Only the end of each line (its newline, or the end
+/// of the buffer for an unterminated last line) is stored, as a 32-bit offset relative to its block;
+/// a line's start is the byte after the previous line's end. That's 4 bytes per line, compared to the
+/// 16 bytes of a start/end pair of size_t offsets
+///
+struct line_index
+{
+    const char *buf;          // the indexed buffer
+    size_t size;              // its size in bytes
+    size_t nlines;            // number of lines, including an unterminated last line
+    size_t nnewlines;         // number of newline characters
+    uint32_t *end;            // end[i]: block-relative offset of line i's end
+    size_t nblocks;           // number of 2^32 byte blocks
+    const char **block_base;  // block_base[b]: first byte of block b
+    size_t *block_first;      // block_first[b]: first line ending in block b or later, [nblocks] = nlines
+};
+
+///
+/// Walks the lines of an index in ascending order, carrying the previous line's end so each start comes for free
+///
+struct line_cursor
+{
+    const struct line_index *idx;
+    size_t line;   // the next line to be returned
+    size_t block;  // the block the next line ends in
+    size_t start;  // absolute offset of the next line's first byte
+};
+
+///
+/// Counts the newlines in buf[lo, hi); memchr is vectorized, so this runs at close to memory bandwidth
+///
+static inline size_t lineidx_count(const char *buf, size_t lo, size_t hi)
+{
+    size_t n = 0;
+    const char *p = buf + lo, *e = buf + hi;
+    while(p < e && (p = memchr(p, '\n', (size_t)(e - p))) != NULL)
+    {
+        n++;
+        p++;
+    }
+    return n;
+}
+
+///
+/// Allocates the index once the total number of newlines is known (e.g. by summing lineidx_count over
+/// ranges); lineidx_fill must then be called over ranges covering the whole buffer
+/// \return 0 on success, -1 if an allocation failed
+///
+static inline int lineidx_alloc(struct line_index *idx, const char *buf, size_t size, size_t nnewlines)
+{
+    idx->buf = buf;
+    idx->size = size;
+    idx->nnewlines = nnewlines;
+    idx->nlines = nnewlines + (size > 0 && buf[size - 1] != '\n');
+    idx->nblocks = (size >> LINEIDX_BLOCK_SHIFT) + 1;
+    idx->end = malloc((idx->nlines ? idx->nlines : 1) * sizeof *idx->end);
+    idx->block_base = malloc(idx->nblocks * sizeof *idx->block_base);
+    idx->block_first = malloc((idx->nblocks + 1) * sizeof *idx->block_first);
+    if(!idx->end || !idx->block_base || !idx->block_first)
+    {
+        free(idx->end);
+        free(idx->block_base);
+        free(idx->block_first);
+        return -1;
+    }
+
+    for(size_t b = 0; b < idx->nblocks; b++)
+    {
+        idx->block_base[b] = buf + (b << LINEIDX_BLOCK_SHIFT);
+
+        // a block starting exactly at the end of the buffer holds only the unterminated last line
+        // (if there is one), which no range passed to lineidx_fill will ever reach
+        idx->block_first[b] = nnewlines;
+    }
+    idx->block_first[idx->nblocks] = idx->nlines;
+
+    // the unterminated last line ends at the end of the buffer
+    if(idx->nlines > nnewlines)
+        idx->end[idx->nlines - 1] = (uint32_t)(size & LINEIDX_BLOCK_MASK);
+    return 0;
+}
+
+///
+/// Records the lines ending at each newline in buf[lo, hi)
+/// \param idx an index set up by lineidx_alloc
+/// \param lo first byte of the range
+/// \param hi one past the last byte of the range
+/// \param first_line number of newlines before lo, i.e. the index of the first line ending in the range
+///
+static inline void lineidx_fill(struct line_index *idx, size_t lo, size_t hi, size_t first_line)
+{
+    const char *buf = idx->buf;
+    size_t line = first_line;
+
+    // the next block boundary at or after lo; block_first for a boundary is the number of newlines before it
+    size_t b = (lo + LINEIDX_BLOCK_MASK) >> LINEIDX_BLOCK_SHIFT;
+
+    const char *p = buf + lo, *e = buf + hi;
+    while(p < e && (p = memchr(p, '\n', (size_t)(e - p))) != NULL)
+    {
+        size_t off = (size_t)(p - buf);
+        while((b << LINEIDX_BLOCK_SHIFT) <= off && b < idx->nblocks)
+            idx->block_first[b++] = line;
+        idx->end[line++] = (uint32_t)(off & LINEIDX_BLOCK_MASK);
+        p++;
+    }
+    while((b << LINEIDX_BLOCK_SHIFT) < hi && b < idx->nblocks)
+        idx->block_first[b++] = line;
+}
+
+///
+/// Builds the index over the whole buffer on the calling thread
+/// \return 0 on success, -1 if an allocation failed
+///
+static inline int lineidx_build(struct line_index *idx, const char *buf, size_t size)
+{
+    if(lineidx_alloc(idx, buf, size, lineidx_count(buf, 0, size)) != 0)
+        return -1;
+    lineidx_fill(idx, 0, size, 0);
+    return 0;
+}
+
+///
+/// Releases the index (but not the buffer it points into)
+///
+static inline void lineidx_free(struct line_index *idx)
+{
+    free(idx->end);
+    free(idx->block_base);
+    free(idx->block_first);
+}
+
+///
+/// Bytes of metadata the index keeps, for comparison against the old per-line layouts
+///
+static inline size_t lineidx_bytes(const struct line_index *idx)
+{
+    return idx->nlines * sizeof *idx->end
+         + idx->nblocks * (sizeof *idx->block_base + sizeof *idx->block_first) + sizeof *idx->block_first;
+}
+
+///
+/// Absolute offset of the end of line i, given the block it ends in
+///
+static inline size_t lineidx_end_in(const struct line_index *idx, size_t i, size_t block)
+{
+    return (size_t)(idx->block_base[block] - idx->buf) + idx->end[i];
+}
+
+///
+/// Positions a cursor so the next call to lineidx_next returns line
+///
+static inline void lineidx_cursor_init(struct line_cursor *c, const struct line_index *idx, size_t line)
+{
+    c->idx = idx;
+    c->line = line;
+
+    // finds the last block whose first line is at or before the previous line (binary search)
+    size_t want = line ? line - 1 : 0;
+    size_t lo = 0, hi = idx->nblocks - 1;
+    while(lo < hi)
+    {
+        size_t mid = (lo + hi + 1) / 2;
+        if(idx->block_first[mid] <= want)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    c->block = lo;
+    c->start = line ? lineidx_end_in(idx, line - 1, lo) + 1 : 0;
+}
+
+///
+/// Returns the next line as the half-open byte range [*s, *e) of the buffer, newline excluded
+///
+static inline void lineidx_next(struct line_cursor *c, size_t *s, size_t *e)
+{
+    const struct line_index *idx = c->idx;
+    while(idx->block_first[c->block + 1] <= c->line)
+        c->block++;
+    *s = c->start;
+    *e = lineidx_end_in(idx, c->line, c->block);
+    c->start = *e + 1;
+    c->line++;
+}
+
+#endif
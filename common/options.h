@@ -0,0 +1,331 @@
+#ifndef COMMON_OPTIONS_H
+#define COMMON_OPTIONS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the backends, as passed to parse_options and combined into the set of backends an option applies to
+#define BACKEND_PTHREAD 1
+#define BACKEND_OPENMP 2
+#define BACKEND_MPI 4
+#define BACKEND_ALL (BACKEND_PTHREAD | BACKEND_OPENMP | BACKEND_MPI)
+
+///
+/// Command line options shared by the pthread, OpenMP and MPI implementations. Every option starts
+/// with "--" so it can't be confused with the positional arguments (file path, thread count)
+///
+struct run_options
+{
+    int parallel_output;        // --parallel-output: each worker formats its own lines
+    const char *output_path;    // --output=FILE: write results into FILE instead of stdout
+    int index_stats;            // --index-stats: report the memory taken by the line index
+    int summary;                // --summary: print a histogram of the per-line values instead of every line
+    size_t top_k;               // --top-k=K: print only the K lines with the highest values (0 = off)
+    int digest;                 // --digest: print an order-dependent hash of the (line, value) pairs instead
+    unsigned min_value;         // --min-value=V: only lines whose value is at least V are reported
+    const char *byte_class;     // --class=CLASS: the bytes that count towards a line's value (NULL = the default)
+    size_t slab_size;           // --slab-size=SIZE: MPI reads its chunk in pipelined slabs (0 = off), pthread
+                                // and OpenMP read pipes in batches of SIZE (0 = STREAM_BATCH)
+    unsigned long long limit_bytes; // --limit-bytes=SIZE: only the first SIZE bytes of the input are read (0 = all)
+    int shm;                    // --shm: MPI ranks on a node share one input buffer and result array
+    int stats;                  // --stats: MPI reports phase times and buffer sizes on stderr
+    const char *io_hints;       // --io-hints=LIST: MPI-IO hints ("key=value,...") for opening the input and output
+    int counters;               // --counters: report hardware and software counters per phase on stderr
+    int pin;                    // --pin: pin each thread (or rank) to its own CPU
+    int affinity;               // --affinity: report each worker's CPU and their clock on stderr
+    size_t chunk_lines;         // --chunk-lines=N: OpenMP schedules the scan in chunks of N lines (0 = static)
+    int io_read;                // --io=read: OpenMP reads the file into memory instead of mapping it
+    int auto_tune;              // --auto-tune: take threads, chunk size and I/O mode from the host's profile
+    int retune;                 // --retune: calibrate again even if the profile has an entry
+    const char *tune_profile;   // --tune-profile=FILE: profile to use instead of $HOME/.3way_tune_<host>
+    const char *xml;            // --xml[=NAMES]: OpenMP only scans the content of these XML elements (NULL = off)
+    int follow;                 // --follow: OpenMP keeps scanning lines appended to the file until it's removed
+    double approx;              // --approx=FRACTION[,SEED]: estimate the histogram from this share of the input (0 = off)
+    unsigned long long approx_seed; // the seed that picks the sampled blocks, 1 by default
+};
+
+///
+/// Prints the options understood by parse_options, used by each executable's usage message
+///
+static inline void print_options_usage(void)
+{
+    fprintf(stderr,
+        "Options:\n"
+        "  --parallel-output   format the results in parallel, one buffer per worker\n"
+        "  --output=FILE       write the results into FILE (implies --parallel-output)\n"
+        "  --index-stats       (pthread, OpenMP) report the per-line metadata memory on stderr\n"
+        "  --summary           print a histogram of the per-line values instead of every line\n"
+        "  --top-k=K           print only the K lines with the highest values\n"
+        "  --digest            print a hash of the (line, value) pairs and the line count instead of every line\n"
+        "  --min-value=V       only report lines whose value is at least V\n"
+        "  --class=CLASS       only count the bytes of CLASS: printable (32-126, the OpenMP and MPI default),\n"
+        "                      ascii, alnum, letters (case-folded to lower case) or set:BYTES, e.g. set:a-f0-9_\n"
+        "  --slab-size=SIZE    (MPI) read each rank's chunk in pipelined slabs of SIZE bytes, e.g. 64M;\n"
+        "                      (pthread, OpenMP) read pipes and stdin (\"-\") in batches of SIZE bytes\n"
+        "  --limit-bytes=SIZE  only read the first SIZE bytes of the input, like head -c SIZE\n"
+        "  --shm               (MPI) share one input buffer and result array between the ranks of a node\n"
+        "  --stats             (MPI) report phase times and buffer sizes on stderr, (OpenMP) see --xml\n"
+        "  --io-hints=LIST     (MPI) MPI-IO hints for the input and output files, e.g. cb_nodes=4,cb_buffer_size=16M,\n"
+        "                      romio_cb_read=enable,striping_factor=8,striping_unit=1M (added to $THREEWAY_IO_HINTS)\n"
+        "  --counters          report perf_event counters per phase as CSV rows on stderr\n"
+        "  --pin               pin each thread (or each rank, within its node) to its own CPU\n"
+        "  --affinity          report the CPU every thread or rank ran on and their clock on stderr\n"
+        "  --chunk-lines=N     (OpenMP) hand out the lines in dynamically scheduled chunks of N lines\n"
+        "  --io=MODE           (OpenMP) mmap (default) or read the input into memory\n"
+        "  --auto-tune         (OpenMP) use the host's tuning profile, calibrating on a sample if needed\n"
+        "  --retune            (OpenMP) calibrate again and update the profile (implies --auto-tune)\n"
+        "  --tune-profile=FILE (OpenMP) profile to use instead of $HOME/.3way_tune_<hostname>\n"
+        "  --xml[=NAMES]       (OpenMP) only scan the content of these XML elements, comma-separated (default text);\n"
+        "                      lines without any such content get 0. With --stats, report the passes' throughput\n"
+        "  --follow            (OpenMP) keep scanning the lines appended to the file, like tail -f, until it's\n"
+        "                      removed, renamed or truncated\n"
+        "  --approx=F[,SEED]   (OpenMP, MPI) estimate the --summary histogram and line count with 95%% confidence\n"
+        "                      intervals from randomly sampled blocks making up a fraction F (0-1] of the input;\n"
+        "                      a line running more than a block past its block is cut off there unless F is 1\n");
+}
+
+///
+/// Parses the unsigned number after an "--option=" prefix
+/// \return 0 on success, -1 if the text isn't a number within [min, max]
+///
+static inline int parse_option_number(const char *text, unsigned long long min, unsigned long long max,
+                                      unsigned long long *value)
+{
+    char *end;
+    if(*text < '0' || *text > '9')
+        return -1;
+    *value = strtoull(text, &end, 10);
+    return (*end == '\0' && *value >= min && *value <= max) ? 0 : -1;
+}
+
+///
+/// Parses a byte count with an optional K, M or G suffix (powers of 1024), like the sizes the scripts use
+/// \return 0 on success, -1 if the text isn't a size within [min, max]
+///
+static inline int parse_option_size(const char *text, unsigned long long min, unsigned long long max,
+                                    unsigned long long *value)
+{
+    char *end;
+    if(*text < '0' || *text > '9')
+        return -1;
+    *value = strtoull(text, &end, 10);
+    int shift = 0;
+    if(*end == 'K' || *end == 'k')
+        shift = 10;
+    else if(*end == 'M' || *end == 'm')
+        shift = 20;
+    else if(*end == 'G' || *end == 'g')
+        shift = 30;
+    if(shift)
+    {
+        end++;
+        if(*value > (max >> shift))
+            return -1;
+        *value <<= shift;
+    }
+    return (*end == '\0' && *value >= min && *value <= max) ? 0 : -1;
+}
+
+///
+/// Splits argv into options and positional arguments. An option the calling backend doesn't implement is
+/// an error like an unknown one, rather than being ignored
+/// \param argc number of arguments passed to the executable
+/// \param argv the arguments passed in text form
+/// \param backend the calling backend, one of the BACKEND_ bits
+/// \param opts filled in with the options that were given, everything else is zeroed
+/// \param positional receives the positional arguments in their original order
+/// \param max_positional capacity of the positional array
+/// \return the number of positional arguments, or -1 if an option was not recognized or isn't supported
+///
+static inline int parse_options(int argc, char *argv[], unsigned backend, struct run_options *opts,
+                                const char **positional, int max_positional)
+{
+    int npos = 0;
+    memset(opts, 0, sizeof *opts);
+
+    for(int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        unsigned backends = BACKEND_ALL;    // the backends the option applies to
+
+        // anything that isn't an option (including a lone "-") is passed through as positional
+        if(strncmp(arg, "--", 2) != 0)
+        {
+            if(npos == max_positional)
+                return -1;
+            positional[npos++] = arg;
+            continue;
+        }
+
+        if(!strcmp(arg, "--parallel-output"))
+        {
+            opts->parallel_output = 1;
+        }
+        else if(!strncmp(arg, "--output=", 9) && arg[9] != '\0')
+        {
+            opts->output_path = arg + 9;
+            opts->parallel_output = 1;
+        }
+        else if(!strcmp(arg, "--index-stats"))
+        {
+            opts->index_stats = 1;
+            backends = BACKEND_PTHREAD | BACKEND_OPENMP;
+        }
+        else if(!strcmp(arg, "--summary"))
+        {
+            opts->summary = 1;
+        }
+        else if(!strcmp(arg, "--digest"))
+        {
+            opts->digest = 1;
+        }
+        else if(!strncmp(arg, "--top-k=", 8))
+        {
+            unsigned long long k;
+            if(parse_option_number(arg + 8, 1, 1000000, &k) != 0)
+            {
+                fprintf(stderr, "Invalid top-k count: %s\n", arg + 8);
+                return -1;
+            }
+            opts->top_k = (size_t)k;
+        }
+        else if(!strncmp(arg, "--min-value=", 12))
+        {
+            unsigned long long v;
+            if(parse_option_number(arg + 12, 0, 255, &v) != 0)
+            {
+                fprintf(stderr, "Invalid minimum value: %s\n", arg + 12);
+                return -1;
+            }
+            opts->min_value = (unsigned)v;
+        }
+        else if(!strncmp(arg, "--class=", 8) && arg[8] != '\0')
+        {
+            opts->byte_class = arg + 8;
+        }
+        else if(!strcmp(arg, "--shm"))
+        {
+            opts->shm = 1;
+            backends = BACKEND_MPI;
+        }
+        else if(!strcmp(arg, "--stats"))
+        {
+            opts->stats = 1;
+            backends = BACKEND_MPI | BACKEND_OPENMP;
+        }
+        else if(!strncmp(arg, "--io-hints=", 11) && arg[11] != '\0')
+        {
+            opts->io_hints = arg + 11;
+            backends = BACKEND_MPI;
+        }
+        else if(!strcmp(arg, "--counters"))
+        {
+            opts->counters = 1;
+        }
+        else if(!strcmp(arg, "--pin"))
+        {
+            opts->pin = 1;
+        }
+        else if(!strcmp(arg, "--affinity"))
+        {
+            opts->affinity = 1;
+        }
+        else if(!strncmp(arg, "--chunk-lines=", 14))
+        {
+            unsigned long long n;
+            if(parse_option_number(arg + 14, 0, 1ULL << 32, &n) != 0)
+            {
+                fprintf(stderr, "Invalid chunk size: %s\n", arg + 14);
+                return -1;
+            }
+            opts->chunk_lines = (size_t)n;
+            backends = BACKEND_OPENMP;
+        }
+        else if(!strcmp(arg, "--io=mmap") || !strcmp(arg, "--io=read"))
+        {
+            opts->io_read = !strcmp(arg, "--io=read");
+            backends = BACKEND_OPENMP;
+        }
+        else if(!strcmp(arg, "--auto-tune"))
+        {
+            opts->auto_tune = 1;
+            backends = BACKEND_OPENMP;
+        }
+        else if(!strcmp(arg, "--retune"))
+        {
+            opts->auto_tune = 1;
+            opts->retune = 1;
+            backends = BACKEND_OPENMP;
+        }
+        else if(!strncmp(arg, "--tune-profile=", 15) && arg[15] != '\0')
+        {
+            opts->tune_profile = arg + 15;
+            backends = BACKEND_OPENMP;
+        }
+        else if(!strcmp(arg, "--xml"))
+        {
+            opts->xml = "text";
+            backends = BACKEND_OPENMP;
+        }
+        else if(!strncmp(arg, "--xml=", 6) && arg[6] != '\0')
+        {
+            opts->xml = arg + 6;
+            backends = BACKEND_OPENMP;
+        }
+        else if(!strcmp(arg, "--follow"))
+        {
+            opts->follow = 1;
+            backends = BACKEND_OPENMP;
+        }
+        else if(!strncmp(arg, "--approx=", 9))
+        {
+            char *end;
+            opts->approx = strtod(arg + 9, &end);
+            opts->approx_seed = 1;
+            backends = BACKEND_OPENMP | BACKEND_MPI;
+            if(*end == ',' && parse_option_number(end + 1, 0, ~0ULL, &opts->approx_seed) == 0)
+                end += strlen(end);
+            if(end == arg + 9 || *end != '\0' || !(opts->approx > 0 && opts->approx <= 1))
+            {
+                fprintf(stderr, "Invalid sample fraction: %s\n", arg + 9);
+                return -1;
+            }
+        }
+        else if(!strncmp(arg, "--slab-size=", 12))
+        {
+            // slabs are read with one MPI call each, whose count is an int
+            unsigned long long v;
+            if(parse_option_size(arg + 12, 1, 1ULL << 30, &v) != 0)
+            {
+                fprintf(stderr, "Invalid slab size: %s\n", arg + 12);
+                return -1;
+            }
+            opts->slab_size = (size_t)v;
+        }
+        else if(!strncmp(arg, "--limit-bytes=", 14))
+        {
+            if(parse_option_size(arg + 14, 1, 1ULL << 50, &opts->limit_bytes) != 0)
+            {
+                fprintf(stderr, "Invalid byte limit: %s\n", arg + 14);
+                return -1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return -1;
+        }
+
+        if(!(backends & backend))
+        {
+            fprintf(stderr, "Option not supported by the %s version: %.*s\n",
+                    backend == BACKEND_PTHREAD ? "pthread" : backend == BACKEND_OPENMP ? "OpenMP" : "MPI",
+                    (int)strcspn(arg, "="), arg);
+            return -1;
+        }
+    }
+    return npos;
+}
+
+#endif
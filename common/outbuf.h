@@ -0,0 +1,190 @@
+#ifndef COMMON_OUTBUF_H
+#define COMMON_OUTBUF_H
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// longest "N: V\n" record: 20 digits for a 64-bit line number, ": ", 3 digits for the value and a newline
+#define OUT_MAX_LINE 26
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+///
+/// A private output buffer; each worker formats its contiguous range of lines into its own one
+///
+struct out_buffer
+{
+    char *data;
+    size_t len;
+};
+
+///
+/// Allocates a buffer large enough to hold nlines formatted records
+/// \param ob the buffer to initialize
+/// \param nlines the number of records that will be appended
+/// \return 0 on success, -1 if the allocation failed
+///
+static inline int out_buffer_init(struct out_buffer *ob, size_t nlines)
+{
+    ob->len = 0;
+    ob->data = malloc(nlines ? nlines * OUT_MAX_LINE : 1);
+    return ob->data ? 0 : -1;
+}
+
+///
+/// Appends one "line: value\n" record, producing exactly what printf("%zu: %d\n") would but without
+/// parsing a format string for every line
+/// \param ob the buffer being appended to, must have room for OUT_MAX_LINE more bytes
+/// \param line the global (zero-based) line number
+/// \param value the line's maximum value, 0-255
+///
+static inline void out_append(struct out_buffer *ob, size_t line, unsigned value)
+{
+    char digits[20];
+    int n = 0;
+    char *p = ob->data + ob->len;
+
+    // line numbers come out least significant digit first, so they're reversed into place
+    do
+    {
+        digits[n++] = (char)('0' + line % 10);
+        line /= 10;
+    } while(line);
+    while(n)
+        *p++ = digits[--n];
+
+    *p++ = ':';
+    *p++ = ' ';
+    if(value >= 100)
+        *p++ = (char)('0' + value / 100);
+    if(value >= 10)
+        *p++ = (char)('0' + value / 10 % 10);
+    *p++ = (char)('0' + value % 10);
+    *p++ = '\n';
+
+    ob->len = (size_t)(p - ob->data);
+}
+
+///
+/// Writes len bytes to fd, retrying after short writes
+/// \return 0 on success, -1 on a write error
+///
+static inline int write_all(int fd, const char *p, size_t len)
+{
+    while(len)
+    {
+        ssize_t w = write(fd, p, len);
+        if(w < 0)
+        {
+            perror("write");
+            return -1;
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+///
+/// Writes the buffers to fd in order with as few writev calls as possible
+/// \param fd the descriptor to write to (usually STDOUT_FILENO)
+/// \param bufs the per-worker buffers, in line order
+/// \param n the number of buffers
+/// \return 0 on success, -1 on a write error
+///
+static inline int write_buffers_ordered(int fd, const struct out_buffer *bufs, int n)
+{
+    struct iovec iov[IOV_MAX];
+    int i = 0;
+
+    while(i < n)
+    {
+        // gathers up to IOV_MAX non-empty buffers into one writev call
+        int cnt = 0;
+        size_t total = 0;
+        int first = i;
+        for(; i < n && cnt < IOV_MAX; i++)
+        {
+            if(!bufs[i].len)
+                continue;
+            iov[cnt].iov_base = bufs[i].data;
+            iov[cnt].iov_len = bufs[i].len;
+            total += bufs[i].len;
+            cnt++;
+        }
+        if(!cnt)
+            continue;
+
+        ssize_t w = writev(fd, iov, cnt);
+        if(w < 0)
+        {
+            perror("writev");
+            return -1;
+        }
+
+        // a short writev (pipes, signals) leaves the tail of this batch, which is finished with write_all
+        if((size_t)w < total)
+        {
+            size_t skip = (size_t)w;
+            for(int j = first; j < i; j++)
+            {
+                if(skip >= bufs[j].len)
+                {
+                    skip -= bufs[j].len;
+                    continue;
+                }
+                if(write_all(fd, bufs[j].data + skip, bufs[j].len - skip))
+                    return -1;
+                skip = 0;
+            }
+        }
+    }
+    return 0;
+}
+
+///
+/// Creates (or truncates) path, sizes it to exactly size bytes and maps it writable so workers can
+/// copy their buffers straight to their precomputed offsets
+/// \param path the output file
+/// \param size the total number of bytes that will be written
+/// \param map receives the mapping, or NULL when size is 0 (nothing to map)
+/// \return 0 on success, -1 on failure (an error has been printed)
+///
+static inline int out_file_map(const char *path, size_t size, char **map)
+{
+    *map = NULL;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        perror("open output");
+        return -1;
+    }
+    if(ftruncate(fd, (off_t)size) != 0)
+    {
+        perror("ftruncate");
+        close(fd);
+        return -1;
+    }
+    if(size)
+    {
+        char *m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(m == MAP_FAILED)
+        {
+            perror("mmap output");
+            close(fd);
+            return -1;
+        }
+        *map = m;
+    }
+    close(fd);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,251 @@
+#ifndef COMMON_STREAM_H
+#define COMMON_STREAM_H
+
+// needs _GNU_SOURCE, defined at the top of each implementation, for memrchr
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// default size of the batches a stream is read in; a batch only grows past it for a line that's longer
+#define STREAM_BATCH (64 << 20)
+
+///
+/// Reads a pipe or stdin in large batches of whole lines into one recycled buffer, so inputs that can't
+/// be mapped are processed batch by batch and results come out before the input ends. Each batch ends
+/// after its last newline; the incomplete line after it is moved to the front of the buffer and
+/// completed by the next read. splice can only move data between a pipe and a file or socket, not into
+/// memory the process reads itself, so the batches are filled with plain read calls
+///
+struct line_stream
+{
+    int fd;
+    char *buf;
+    size_t cap;                 // buffer size
+    size_t len;                 // bytes in buf: the current batch and the start of the next one
+    size_t batch;               // length of the batch returned by the last stream_next
+    size_t searched;            // bytes at the front of buf already searched for newlines
+    size_t lines_end;           // offset just past the last newline in those bytes, 0 if there's none
+    unsigned long long left;    // bytes that may still be read (--limit-bytes)
+    int eof;
+    int watch;                  // --follow: inotify descriptor watching the file, -1 when not following
+};
+
+///
+/// Sets up a stream reading fd in batches of about cap bytes, stopping after limit bytes (0 = no limit)
+/// \return 0 on success, -1 if the buffer couldn't be allocated
+///
+static inline int stream_init(struct line_stream *ls, int fd, size_t cap, unsigned long long limit)
+{
+    ls->fd = fd;
+    ls->cap = cap ? cap : STREAM_BATCH;
+    ls->buf = malloc(ls->cap);
+    ls->len = 0;
+    ls->batch = 0;
+    ls->searched = 0;
+    ls->lines_end = 0;
+    ls->left = limit ? limit : ~0ULL;
+    ls->eof = 0;
+    ls->watch = -1;
+    return ls->buf ? 0 : -1;
+}
+
+///
+/// --follow: makes the stream treat the end of the regular file it reads as the end of what has been
+/// written so far. The whole lines read are handed out as usual, a partial last line is held back until
+/// its newline arrives, and when there's nothing left to hand out stream_next blocks until inotify
+/// reports that the file changed. Following ends when the file is removed, renamed or truncated. The
+/// open descriptor keeps a removed file's inode alive, so IN_DELETE_SELF isn't reported until it's
+/// closed; removing it does change its link count, which IN_ATTRIB reports
+/// \param path the file fd was opened from
+/// \return 0 on success, -1 if the watch couldn't be set up
+///
+static inline int stream_follow(struct line_stream *ls, const char *path)
+{
+    ls->watch = inotify_init1(IN_CLOEXEC);
+    if(ls->watch < 0 || inotify_add_watch(ls->watch, path, IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB
+                                          | IN_DELETE_SELF | IN_MOVE_SELF) < 0)
+    {
+        perror("inotify");
+        if(ls->watch >= 0)
+            close(ls->watch);
+        ls->watch = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// stops following: the data already in the file is still read, then the stream ends
+static inline void stream_unfollow(struct line_stream *ls)
+{
+    close(ls->watch);
+    ls->watch = -1;
+}
+
+///
+/// Blocks until the followed file changes. The watch is set up before the file is first read, so an append
+/// that happens between a read reaching the end of the file and this call is still queued as an event
+/// \return 0 if the file may have grown, -1 if following has ended
+///
+static inline int stream_wait(struct line_stream *ls)
+{
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n = read(ls->watch, events, sizeof events);
+    if(n < 0 && errno == EINTR)
+        return 0;
+    if(n <= 0)
+        return -1;
+    for(char *p = events; p < events + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len)
+    {
+        if(((struct inotify_event *)p)->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+            return -1;
+    }
+
+    // a removed file has no links left, though the descriptor still reads it; a file rewritten from the
+    // start would otherwise be read from the old offset on
+    struct stat st;
+    if(fstat(ls->fd, &st) != 0 || st.st_nlink == 0)
+        return -1;
+    if(st.st_size < lseek(ls->fd, 0, SEEK_CUR))
+    {
+        fprintf(stderr, "Followed file was truncated\n");
+        return -1;
+    }
+    return 0;
+}
+
+static inline void stream_free(struct line_stream *ls)
+{
+    if(ls->watch >= 0)
+        stream_unfollow(ls);
+    free(ls->buf);
+    ls->buf = NULL;
+}
+
+///
+/// Offset just past the last newline in the buffer, 0 if there's none. Only the bytes read since the last
+/// call are searched, so a long line that arrives in many short reads is searched once, not once per read
+///
+static inline size_t stream_lines_end(struct line_stream *ls)
+{
+    const char *nl = memrchr(ls->buf + ls->searched, '\n', ls->len - ls->searched);
+    if(nl)
+        ls->lines_end = (size_t)(nl - ls->buf) + 1;
+    ls->searched = ls->len;
+    return ls->lines_end;
+}
+
+///
+/// True when a read from fd wouldn't block (data, end of input or an error is waiting)
+///
+static inline int stream_ready(int fd)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+///
+/// Returns the next batch of whole lines; only the last batch of the input can end in an unterminated
+/// line. The batch stays valid until the next call
+/// \param ls the stream
+/// \param batch receives the start of the batch
+/// \return the batch length, 0 at the end of the input, or -1 on a read or allocation error
+///
+static inline long long stream_next(struct line_stream *ls, const char **batch)
+{
+    // moves the incomplete line left over after the previous batch to the front
+    if(ls->batch)
+    {
+        memmove(ls->buf, ls->buf + ls->batch, ls->len - ls->batch);
+        ls->len -= ls->batch;
+        ls->searched = ls->searched > ls->batch ? ls->searched - ls->batch : 0;
+        ls->lines_end = ls->lines_end > ls->batch ? ls->lines_end - ls->batch : 0;
+        ls->batch = 0;
+    }
+
+    int wait = 0;
+    for(;;)
+    {
+        // fills the buffer until it's full or the input (or the byte limit) ends; a pipe hands out at
+        // most its capacity per read, so this takes many reads
+        while(!ls->eof && ls->len < ls->cap)
+        {
+            // a producer with nothing more to hand over right now ends the batch early, so a slow feed
+            // gets its results as its lines arrive instead of once a whole batch has filled up
+            if(ls->len && !wait && !stream_ready(ls->fd))
+                break;
+            wait = 0;
+
+            size_t want = ls->cap - ls->len;
+            if(want > ls->left)
+                want = (size_t)ls->left;
+            ssize_t r = want ? read(ls->fd, ls->buf + ls->len, want) : 0;
+            if(r < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                perror("read");
+                return -1;
+            }
+            if(r == 0)
+            {
+                if(ls->watch < 0 || !ls->left)
+                {
+                    ls->eof = 1;
+                    break;
+                }
+
+                // --follow: the whole lines that have arrived are handed out right away; only when there
+                // are none does the stream wait for the file to grow
+                if(stream_lines_end(ls))
+                    break;
+                if(stream_wait(ls) != 0)
+                    stream_unfollow(ls);
+                continue;
+            }
+            ls->len += (size_t)r;
+            ls->left -= (unsigned long long)r;
+        }
+
+        // at the end of the input everything left is the last batch
+        if(ls->eof)
+        {
+            ls->batch = ls->len;
+            break;
+        }
+
+        // otherwise the batch ends after the last newline in the buffer
+        size_t end = stream_lines_end(ls);
+        if(end)
+        {
+            ls->batch = end;
+            break;
+        }
+
+        // no whole line has arrived yet, so the next read waits for more
+        if(ls->len < ls->cap)
+        {
+            wait = 1;
+            continue;
+        }
+
+        // a single line fills the whole buffer, which grows until the line fits
+        char *grown = realloc(ls->buf, ls->cap * 2);
+        if(!grown)
+        {
+            perror("realloc");
+            return -1;
+        }
+        ls->buf = grown;
+        ls->cap *= 2;
+    }
+
+    *batch = ls->buf;
+    return (long long)ls->batch;
+}
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef COMMON_TUNE_H
+#define COMMON_TUNE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// most thread counts tried during calibration: powers of two plus the topology-derived counts
+#define TUNE_MAX_CANDIDATES 32
+
+// a larger thread count or a finer schedule is only picked if it's at least this much faster, so noise
+// in the short calibration scans doesn't push runs onto more threads than they benefit from
+#define TUNE_MIN_GAIN 0.05
+
+///
+/// What the auto-tuner decides for one backend and input size class
+///
+struct tune_choice
+{
+    int threads;           // worker threads
+    size_t chunk_lines;    // lines per dynamically scheduled chunk, 0 = one contiguous range per thread
+    int io_read;           // 1: read the file into memory with pread, 0: mmap it
+};
+
+///
+/// Inputs whose sizes are within a factor of two of each other share a profile entry: the class is
+/// floor(log2(bytes)), so 720M and 1000M fall into the same class but 240M and 720M don't
+///
+static inline int tune_size_class(size_t bytes)
+{
+    int c = 0;
+    while(bytes >>= 1)
+        c++;
+    return c;
+}
+
+///
+/// Builds the path of this host's profile, $HOME/.3way_tune_<hostname>, unless one was given
+///
+static inline void tune_profile_path(char *out, size_t cap, const char *given)
+{
+    char host[256] = "localhost";
+    const char *home = getenv("HOME");
+    if(given)
+    {
+        snprintf(out, cap, "%s", given);
+        return;
+    }
+    gethostname(host, sizeof host - 1);
+    host[sizeof host - 1] = '\0';
+    snprintf(out, cap, "%s/.3way_tune_%s", home ? home : ".", host);
+}
+
+///
+/// Looks up the entry for backend and size_class in a profile, whose lines read
+/// "<backend> <size class> <threads> <chunk lines> <mmap|read>"; lines starting with '#' are comments
+/// \return 0 if an entry was found, -1 otherwise
+///
+static inline int tune_profile_load(const char *path, const char *backend, int size_class, struct tune_choice *c)
+{
+    FILE *f = fopen(path, "r");
+    char line[256], name[64], io[16];
+    int cls, threads, found = -1;
+    unsigned long long chunk;
+    if(!f)
+        return -1;
+    while(fgets(line, sizeof line, f))
+    {
+        if(line[0] == '#')
+            continue;
+        if(sscanf(line, "%63s %d %d %llu %15s", name, &cls, &threads, &chunk, io) == 5
+           && !strcmp(name, backend) && cls == size_class && threads > 0)
+        {
+            c->threads = threads;
+            c->chunk_lines = (size_t)chunk;
+            c->io_read = !strcmp(io, "read");
+            found = 0;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+///
+/// Stores the entry for backend and size_class, keeping every other entry of the profile; the new
+/// profile is written next to the old one and renamed over it, so a concurrent run never reads half a file
+/// \return 0 on success, -1 if the profile couldn't be written
+///
+static inline int tune_profile_save(const char *path, const char *backend, int size_class, const struct tune_choice *c)
+{
+    char tmp[4096 + 32], line[256], name[64];
+    int cls;
+    snprintf(tmp, sizeof tmp, "%s.%ld", path, (long)getpid());
+    FILE *out = fopen(tmp, "w");
+    if(!out)
+    {
+        perror("tune profile");
+        return -1;
+    }
+    fprintf(out, "# backend size_class(log2 bytes) threads chunk_lines(0=static) io\n");
+
+    FILE *in = fopen(path, "r");
+    if(in)
+    {
+        while(fgets(line, sizeof line, in))
+        {
+            if(line[0] == '#')
+                continue;
+            if(sscanf(line, "%63s %d", name, &cls) == 2 && !strcmp(name, backend) && cls == size_class)
+                continue;
+            fputs(line, out);
+        }
+        fclose(in);
+    }
+    fprintf(out, "%s %d %d %zu %s\n", backend, size_class, c->threads, c->chunk_lines, c->io_read ? "read" : "mmap");
+
+    if(fclose(out) != 0 || rename(tmp, path) != 0)
+    {
+        perror("tune profile");
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// reads one small integer from a sysfs file, or returns -1
+static inline int tune_read_sysfs_int(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    int v = -1;
+    if(f)
+    {
+        if(fscanf(f, "%d", &v) != 1)
+            v = -1;
+        fclose(f);
+    }
+    return v;
+}
+
+///
+/// Counts the NUMA nodes listed under /sys/devices/system/node (1 if there's no such information)
+///
+static inline int tune_numa_nodes(void)
+{
+    char path[128];
+    int n = 0;
+    for(;; n++)
+    {
+        snprintf(path, sizeof path, "/sys/devices/system/node/node%d/cpumap", n);
+        if(access(path, R_OK) != 0)
+            break;
+    }
+    return n ? n : 1;
+}
+
+///
+/// Counts the physical cores among the first ncpu logical CPUs, i.e. the distinct (package, core) pairs
+/// in /sys/devices/system/cpu/cpuN/topology, so hyperthreads can be told apart (ncpu if unknown)
+///
+static inline int tune_physical_cores(int ncpu)
+{
+    int *ids = malloc(2 * (size_t)ncpu * sizeof *ids);
+    int n = 0;
+    char path[128];
+    if(!ids)
+        return ncpu;
+    for(int cpu = 0; cpu < ncpu; cpu++)
+    {
+        snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        int pkg = tune_read_sysfs_int(path);
+        snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        int core = tune_read_sysfs_int(path);
+        if(pkg < 0 || core < 0)
+        {
+            free(ids);
+            return ncpu;
+        }
+        int seen = 0;
+        for(int i = 0; i < n && !seen; i++)
+            seen = ids[2 * i] == pkg && ids[2 * i + 1] == core;
+        if(!seen)
+        {
+            ids[2 * n] = pkg;
+            ids[2 * n + 1] = core;
+            n++;
+        }
+    }
+    free(ids);
+    return n ? n : ncpu;
+}
+
+///
+/// Fills cand with the thread counts worth calibrating on ncpu logical CPUs, in ascending order: the
+/// powers of two below ncpu, the cores of one NUMA node, the physical cores and every logical CPU
+/// \return the number of candidates
+///
+static inline int tune_thread_candidates(int ncpu, int *cand)
+{
+    int extra[3] = { ncpu / tune_numa_nodes(), tune_physical_cores(ncpu), ncpu };
+    int n = 0;
+    for(int t = 1; t < ncpu && n < TUNE_MAX_CANDIDATES - 3; t *= 2)
+        cand[n++] = t;
+    for(int i = 0; i < 3; i++)
+    {
+        int v = extra[i], pos = 0;
+        if(v < 1)
+            continue;
+        while(pos < n && cand[pos] < v)
+            pos++;
+        if(pos < n && cand[pos] == v)
+            continue;
+        memmove(cand + pos + 1, cand + pos, (size_t)(n - pos) * sizeof *cand);
+        cand[pos] = v;
+        n++;
+    }
+    return n;
+}
+
+#endif
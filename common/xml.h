@@ -0,0 +1,196 @@
+#ifndef COMMON_XML_H
+#define COMMON_XML_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// the structural pass looks at the input in blocks of 64 bytes, one bit per byte of a 64-bit mask
+#define XML_BLOCK 64
+
+// most element names --xml accepts
+#define XML_MAX_NAMES 16
+
+///
+/// The elements whose content --xml scans, e.g. "text" or "title,text,comment". The names point into the
+/// option's text, so no copy is kept
+///
+struct xml_filter
+{
+    const char *name[XML_MAX_NAMES];
+    size_t len[XML_MAX_NAMES];
+    int n;
+};
+
+///
+/// The character data of one chosen element: the bytes [start, end) between the '>' of its start tag and
+/// the next '<'. The content of a chosen element is meant to hold no child elements (text, title, comment
+/// and the like in a wiki dump), so its content ends at the next tag; markup inside it is escaped (&lt;)
+///
+struct xml_region
+{
+    size_t start;
+    size_t end;
+};
+
+///
+/// A growing list of regions in ascending order
+///
+struct xml_regions
+{
+    struct xml_region *r;
+    size_t n;
+    size_t cap;
+};
+
+///
+/// Splits a comma-separated list of element names into a filter
+/// \return 0 on success, -1 if a name is empty or there are more than XML_MAX_NAMES
+///
+static inline int xml_filter_init(struct xml_filter *f, const char *list)
+{
+    f->n = 0;
+    for(;;)
+    {
+        size_t len = strcspn(list, ",");
+        if(len == 0 || f->n == XML_MAX_NAMES)
+            return -1;
+        f->name[f->n] = list;
+        f->len[f->n++] = len;
+        if(list[len] == '\0')
+            return 0;
+        list += len + 1;
+    }
+}
+
+///
+/// Stage one of the structural pass: a mask with bit i set where p[i] is '<', for the 64 bytes at p. With
+/// SSE2 (every x86-64 compiler has it) that's four 16-byte compares and movemasks, as in simdjson's
+/// stage 1; otherwise a loop the compiler can vectorize
+///
+static inline uint64_t xml_tag_mask(const char *p)
+{
+#ifdef __SSE2__
+    const __m128i lt = _mm_set1_epi8('<');
+    uint64_t m0 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), lt));
+    uint64_t m1 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), lt));
+    uint64_t m2 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), lt));
+    uint64_t m3 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), lt));
+    return m0 | m1 << 16 | m2 << 32 | m3 << 48;
+#else
+    uint64_t m = 0;
+    for(int i = 0; i < XML_BLOCK; i++)
+        m |= (uint64_t)(p[i] == '<') << i;
+    return m;
+#endif
+}
+
+///
+/// Appends the region [start, end) to a list
+/// \return 0 on success, -1 if the list couldn't grow
+///
+static inline int xml_regions_add(struct xml_regions *rs, size_t start, size_t end)
+{
+    if(rs->n == rs->cap)
+    {
+        size_t cap = rs->cap ? 2 * rs->cap : 1024;
+        struct xml_region *r = realloc(rs->r, cap * sizeof *r);
+        if(!r)
+            return -1;
+        rs->r = r;
+        rs->cap = cap;
+    }
+    rs->r[rs->n].start = start;
+    rs->r[rs->n].end = end;
+    rs->n++;
+    return 0;
+}
+
+///
+/// Stage two, for the tag starting at buf[lt]: if it's the start tag of a chosen element (and not an empty
+/// <name/> tag), adds the element's content to the list. The tag and the content may run past the range
+/// the caller is scanning, up to the end of the buffer
+/// \return 0 on success, -1 if the list couldn't grow
+///
+static inline int xml_tag(const struct xml_filter *f, const char *buf, size_t size, size_t lt, struct xml_regions *rs)
+{
+    const char *name = buf + lt + 1, *e = buf + size;
+    for(int i = 0; i < f->n; i++)
+    {
+        size_t len = f->len[i];
+        if((size_t)(e - name) <= len || memcmp(name, f->name[i], len) != 0)
+            continue;
+
+        // the name must end there: "<text>" or "<text xml:space=...>", but not "<textarea>"
+        char c = name[len];
+        if(c != '>' && c != '/' && c != ' ' && c != '\t' && c != '\n' && c != '\r')
+            continue;
+        const char *gt = memchr(name + len, '>', (size_t)(e - name - len));
+        if(!gt || gt[-1] == '/')
+            return 0;
+
+        const char *start = gt + 1;
+        const char *end = memchr(start, '<', (size_t)(e - start));
+        if(!end)
+            end = e;
+        if(start == end)
+            return 0;
+        return xml_regions_add(rs, (size_t)(start - buf), (size_t)(end - buf));
+    }
+    return 0;
+}
+
+///
+/// Finds the content of the chosen elements whose start tags begin in buf[lo, hi): the '<' of every tag
+/// is located a block at a time with xml_tag_mask and only those tags are looked at, so the bytes in between
+/// are touched once, 16 at a time
+/// \return 0 on success, -1 if the list couldn't grow
+///
+static inline int xml_find_regions(const struct xml_filter *f, const char *buf, size_t size, size_t lo, size_t hi,
+                                   struct xml_regions *rs)
+{
+    size_t p = lo;
+    for(; hi - p >= XML_BLOCK; p += XML_BLOCK)
+    {
+        for(uint64_t m = xml_tag_mask(buf + p); m; m &= m - 1)
+        {
+            if(xml_tag(f, buf, size, p + (size_t)__builtin_ctzll(m), rs) != 0)
+                return -1;
+        }
+    }
+    for(; p < hi; p++)
+    {
+        if(buf[p] == '<' && xml_tag(f, buf, size, p, rs) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+///
+/// Index of the first region of rs that ends after offset, or rs->n (binary search)
+///
+static inline size_t xml_first_region(const struct xml_regions *rs, size_t offset)
+{
+    size_t lo = 0, hi = rs->n;
+    while(lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if(rs->r[mid].end <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static inline void xml_regions_free(struct xml_regions *rs)
+{
+    free(rs->r);
+    rs->r = NULL;
+    rs->n = rs->cap = 0;
+}
+
+#endif
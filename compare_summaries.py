@@ -0,0 +1,40 @@
+#!/usr/bin/env python3
+# compares one metric between two sets of summary files, e.g. the committed analysis/ results against a
+# fresh run after a change:  ./compare_summaries.py old_results/ . max_rss_kb
+import glob, os, re, sys # glob for file search, need re for regular expressions
+
+# reads every <impl>_<size>_<cores>_summary.txt under an analysis/ directory below root and returns
+# {(impl, size, cores): mean} for the given metric
+def load_means(root, metric):
+    pat = re.compile(r'.*/analysis/([^_/]+)_(\d+M)_(\d+)_summary\.txt$')
+    line_re = re.compile(rf'^{metric}\s+([\d\.]+)')
+    means = {}
+    for fn in glob.glob(os.path.join(root, "**/*_summary.txt"), recursive=True):
+        m = pat.match(fn)
+        if not m:
+            continue
+        impl, size, cores = m.groups()
+        with open(fn) as f:
+            for line in f:
+                lm = line_re.match(line.strip())
+                if lm:
+                    means[(impl, size, int(cores))] = float(lm.group(1))
+                    break
+    return means
+
+if __name__ == "__main__":
+    if len(sys.argv) < 3:
+        print(f"usage: {sys.argv[0]} <baseline_dir> <new_dir> [metric (default max_rss_kb)]")
+        sys.exit(1)
+    metric = sys.argv[3] if len(sys.argv) > 3 else "max_rss_kb"
+    old = load_means(sys.argv[1], metric)
+    new = load_means(sys.argv[2], metric)
+
+    # sort by implementation, then numeric size, then cores, and print only combinations found in both
+    keys = sorted(old.keys() & new.keys(), key=lambda k: (k[0], int(k[1][:-1]), k[2]))
+    if not keys:
+        print(f"warning: no matching summaries for {metric}")
+    print(f"{'impl':<10}{'size':>7}{'cores':>6}{'baseline':>14}{'new':>14}{'change':>9}")
+    for k in keys:
+        change = (new[k] - old[k]) / old[k] * 100 if old[k] else 0.0
+        print(f"{k[0]:<10}{k[1]:>7}{k[2]:>6}{old[k]:>14.2f}{new[k]:>14.2f}{change:>8.1f}%")
@@ -70,9 +70,12 @@ def plot_metric(df, metric, ylabel):
 if __name__=="__main__":
     for metric, ylabel in [
         ("wall_s",        "Wall-clock time (s)"),
+        ("wall_s_inliers", "Wall-clock time without outlier trials (s)"),
         ("task_clock_ms", "Task-clock (ms)"),
         ("cpu_pct",       "CPU efficiency (%)"),
         ("max_rss_kb",    "Max RSS (KB)"),
+        ("gbps",          "Read bandwidth (GB/s)"),
+        ("pct_peak",      "Share of the read bandwidth ceiling (%)"),
     ]:
         df = load_summaries(metric)
         if df.empty: